@@ -0,0 +1,44 @@
+#ifndef SP_ABI_H
+#define SP_ABI_H
+
+/**
+ * Inline namespace of the library, named after the build flags that change the layout of the
+ * control blocks or the inline code of the handles: SP_CHECKED, SP_PROFILE_CONTENTION and
+ * SP_TRACK_RETENTION. Translation units built with different flags then declare different
+ * symbols, and passing a handle between them fails to link instead of mixing definitions at run
+ * time. Code names the types as sp::Shared<T> as usual.
+ */
+
+#ifdef SP_CHECKED
+#define SP_ABI_CHECKED _checked
+#else
+#define SP_ABI_CHECKED
+#endif
+
+#ifdef SP_PROFILE_CONTENTION
+#define SP_ABI_CONTENTION _contention
+#else
+#define SP_ABI_CONTENTION
+#endif
+
+#ifdef SP_TRACK_RETENTION
+#define SP_ABI_RETENTION _retention
+#else
+#define SP_ABI_RETENTION
+#endif
+
+// expands the flag suffixes first, then pastes them
+#define SP_ABI_PASTE(base, checked, contention, retention) base##checked##contention##retention
+#define SP_ABI_NAME(base, checked, contention, retention) SP_ABI_PASTE(base, checked, contention, retention)
+#define SP_ABI SP_ABI_NAME(abi_v1, SP_ABI_CHECKED, SP_ABI_CONTENTION, SP_ABI_RETENTION)
+
+#define SP_BEGIN_NAMESPACE \
+  namespace sp             \
+  {                        \
+    inline namespace SP_ABI \
+    {
+#define SP_END_NAMESPACE \
+  }                      \
+  }
+
+#endif // SP_ABI_H
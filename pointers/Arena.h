@@ -0,0 +1,344 @@
+#ifndef SP_ARENA_H
+#define SP_ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "Abi.h"
+
+SP_BEGIN_NAMESPACE
+
+  class Arena;
+
+  /**
+   * @brief Whether the ArenaUnique pointers of an arena run the destructors of their objects
+   */
+  enum class ArenaDestructors
+  {
+    Run,  // Each object is destroyed with its pointer
+    Skip, // Objects are only dropped with the arena memory, for types whose destructors only free arena memory
+  };
+
+  /**
+   * @brief Smart unique pointer on an object allocated in an Arena
+   *
+   * Same move-only ownership as Unique: the destructor runs the destructor of the object, but its
+   * memory is only given back when the arena is reset. Nothing is run for trivially destructible
+   * types or if the arena skips destructors. A pointer still alive when its arena is reset is
+   * abandoned: its object is dropped without being destroyed and the pointer no longer touches it.
+   * In debug builds, dereferencing it fails an assertion. The arena must outlive its pointers.
+   */
+  template <typename T>
+  class ArenaUnique
+  {
+  public:
+    /**
+     * @brief Default constructor, no object
+     */
+    ArenaUnique() = default;
+
+    /**
+     * @brief Move constructor
+     */
+    ArenaUnique(ArenaUnique &&other) noexcept
+        : m_ptr(other.m_ptr), m_arena(other.m_arena), m_generation(other.m_generation)
+    {
+      other.m_ptr = nullptr;
+    }
+
+    /**
+     * @brief Move assignment
+     */
+    ArenaUnique &operator=(ArenaUnique &&other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        m_ptr = other.m_ptr;
+        m_arena = other.m_arena;
+        m_generation = other.m_generation;
+        other.m_ptr = nullptr;
+      }
+      return *this;
+    }
+
+    /**
+     * @brief Destructor
+     */
+    ~ArenaUnique()
+    {
+      reset();
+    }
+
+    // Non-copyable
+    ArenaUnique(const ArenaUnique &) = delete;
+    ArenaUnique &operator=(const ArenaUnique &) = delete;
+
+    /**
+     * @brief Get the raw pointer
+     */
+    T *get() const
+    {
+      check();
+      return m_ptr;
+    }
+
+    /**
+     * @brief Get a reference on pointed data
+     */
+    T &operator*() const
+    {
+      check();
+      return *m_ptr;
+    }
+
+    /**
+     * @brief Get the raw pointer
+     */
+    T *operator->() const
+    {
+      check();
+      return m_ptr;
+    }
+
+    /**
+     * @brief Check if the raw pointer exists
+     */
+    bool exists() const
+    {
+      return m_ptr != nullptr;
+    }
+
+    /**
+     * @brief Check if the raw pointer exists
+     */
+    operator bool() const
+    {
+      return exists();
+    }
+
+    /**
+     * @brief Destroy the object, its memory stays in the arena
+     *
+     * @note nothing is run if the arena was reset since the allocation, the object is gone already
+     */
+    void reset();
+
+  private:
+    friend class Arena;
+
+    T *m_ptr = nullptr;
+    const Arena *m_arena = nullptr;
+    std::size_t m_generation = 0; // Generation of the arena at the allocation
+
+    ArenaUnique(T *ptr, const Arena &arena);
+
+    /**
+     * @brief Check that the arena has not been reset since the allocation, in debug builds
+     */
+    void check() const;
+  };
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  /**
+   * @brief Monotonic chunked allocator
+   *
+   * Allocations bump a cursor in the current chunk, a new chunk is taken when it is full. Memory is
+   * never given back one object at a time: reset() releases everything in one pass over the chunks.
+   */
+  class Arena
+  {
+  public:
+    /**
+     * @brief Constructor takes the size of the chunks, and whether the pointers run the destructors
+     */
+    Arena(std::size_t chunkSize = 64 * 1024, ArenaDestructors destructors = ArenaDestructors::Run)
+        : m_chunkSize(chunkSize), m_destructors(destructors)
+    {
+    }
+
+    /**
+     * @brief Destructor releases every chunk
+     */
+    ~Arena()
+    {
+      release(nullptr);
+    }
+
+    // Non-copyable
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+     * @brief Allocate raw memory
+     *
+     * @return void* never nullptr, throws std::bad_alloc
+     */
+    void *allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+    {
+      std::uintptr_t cursor = (reinterpret_cast<std::uintptr_t>(m_cursor) + alignment - 1) & ~(alignment - 1);
+      if (!m_cursor || cursor + size > reinterpret_cast<std::uintptr_t>(m_end))
+      {
+        grow(size + alignment);
+        cursor = (reinterpret_cast<std::uintptr_t>(m_cursor) + alignment - 1) & ~(alignment - 1);
+      }
+      m_cursor = reinterpret_cast<char *>(cursor + size);
+      return reinterpret_cast<void *>(cursor);
+    }
+
+    /**
+     * @brief make a unique pointer in the arena
+     *
+     * @note usage example: sp::ArenaUnique<T> ptr = arena.makeUnique<T>(args...);
+     */
+    template <typename T, typename... Args>
+    ArenaUnique<T> makeUnique(Args &&...args)
+    {
+      void *memory = allocate(sizeof(T), alignof(T));
+      return ArenaUnique<T>(new (memory) T(std::forward<Args>(args)...), *this);
+    }
+
+    /**
+     * @brief Release every allocation, the first chunk is kept for reuse
+     *
+     * @note the objects still owned by an ArenaUnique are dropped without running their destructors
+     */
+    void reset()
+    {
+      Chunk *first = m_head;
+      while (first && first->next)
+      {
+        first = first->next;
+      }
+      release(first);
+      m_head = first;
+      if (first)
+      {
+        m_cursor = first->data();
+        m_end = first->data() + first->size;
+      }
+      ++m_generation;
+    }
+
+    /**
+     * @brief Get the number of resets so far
+     *
+     * @return std::size_t
+     */
+    std::size_t generation() const
+    {
+      return m_generation;
+    }
+
+    /**
+     * @brief Check if the pointers of this arena run the destructors of their objects
+     *
+     * @return bool
+     */
+    bool runsDestructors() const
+    {
+      return m_destructors == ArenaDestructors::Run;
+    }
+
+    /**
+     * @brief Get the number of chunks in use
+     *
+     * @return std::size_t
+     */
+    std::size_t chunks() const
+    {
+      std::size_t count = 0;
+      for (Chunk *chunk = m_head; chunk; chunk = chunk->next)
+      {
+        ++count;
+      }
+      return count;
+    }
+
+  private:
+    struct alignas(std::max_align_t) Chunk
+    {
+      Chunk *next;
+      std::size_t size;
+
+      char *data()
+      {
+        return reinterpret_cast<char *>(this + 1);
+      }
+    };
+
+    std::size_t m_chunkSize;
+    ArenaDestructors m_destructors;
+    std::size_t m_generation = 0;
+    Chunk *m_head = nullptr;
+    char *m_cursor = nullptr;
+    char *m_end = nullptr;
+
+    /**
+     * @brief Take a new chunk large enough for the given size
+     */
+    void grow(std::size_t size)
+    {
+      std::size_t chunkSize = size > m_chunkSize ? size : m_chunkSize;
+      Chunk *chunk = static_cast<Chunk *>(::operator new(sizeof(Chunk) + chunkSize));
+      chunk->next = m_head;
+      chunk->size = chunkSize;
+      m_head = chunk;
+      m_cursor = chunk->data();
+      m_end = chunk->data() + chunkSize;
+    }
+
+    /**
+     * @brief Release every chunk down to, but not including, the given one
+     */
+    void release(Chunk *keep)
+    {
+      while (m_head != keep)
+      {
+        Chunk *next = m_head->next;
+        ::operator delete(m_head);
+        m_head = next;
+      }
+      m_cursor = nullptr;
+      m_end = nullptr;
+    }
+  };
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  template <typename T>
+  ArenaUnique<T>::ArenaUnique(T *ptr, const Arena &arena)
+      : m_ptr(ptr), m_arena(&arena), m_generation(arena.generation())
+  {
+  }
+
+  template <typename T>
+  void ArenaUnique<T>::reset()
+  {
+    if (m_ptr)
+    {
+      // checked in every build, destroying an object the arena already dropped would touch freed memory
+      if (!std::is_trivially_destructible<T>::value && m_arena->runsDestructors() && m_arena->generation() == m_generation)
+      {
+        m_ptr->~T();
+      }
+      m_ptr = nullptr;
+    }
+  }
+
+  template <typename T>
+  void ArenaUnique<T>::check() const
+  {
+#ifndef NDEBUG
+    assert((!m_ptr || m_arena->generation() == m_generation) && "ArenaUnique used after the reset of its arena");
+#endif
+  }
+
+SP_END_NAMESPACE
+
+#endif // SP_ARENA_H
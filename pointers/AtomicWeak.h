@@ -0,0 +1,206 @@
+#ifndef SP_ATOMICWEAK_H
+#define SP_ATOMICWEAK_H
+
+#include <atomic>
+#include <utility>
+
+#include "Abi.h"
+#include "Hazard.h"
+#include "Shared.h"
+#include "Weak.h"
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Weak pointer slot that many threads may read and overwrite at once
+   *
+   * The slot is a single atomic block pointer and holds one weak reference on the block. Readers
+   * protect the block with a hazard pointer between reading the slot and taking their reference,
+   * so a writer dropping the last weak reference at the same time defers the block deletion
+   * instead of freeing it under them. No operation takes a lock.
+   */
+  template <typename T>
+  class AtomicWeak
+  {
+    static_assert(WeakTraits<T>::enabled, "Weak pointers are disabled for this type by its WeakTraits");
+
+  public:
+    /**
+     * @brief Default constructor, the slot is empty
+     */
+    AtomicWeak() = default;
+
+    /**
+     * @brief Constructor takes the initial Weak pointer
+     */
+    AtomicWeak(Weak<T> weak) : m_block(take(weak))
+    {
+    }
+
+    /**
+     * @brief Destructor drops the reference held by the slot
+     */
+    ~AtomicWeak()
+    {
+      release(m_block.load(std::memory_order_relaxed));
+    }
+
+    // Non-copyable
+    AtomicWeak(const AtomicWeak &) = delete;
+    AtomicWeak &operator=(const AtomicWeak &) = delete;
+
+    /**
+     * @brief Get a copy of the Weak pointer in the slot
+     *
+     * @return Weak<T>
+     */
+    Weak<T> load() const
+    {
+      HazardGuard guard;
+      for (WeakBlockControl *block = m_block.load(std::memory_order_acquire); block;)
+      {
+        WeakBlockControl *current = protect(guard, block);
+        if (current == block && block->tryAddWeak())
+        {
+          return adoptWeak(block);
+        }
+        // the slot changed, the block may be gone already
+        block = current == block ? m_block.load() : current;
+      }
+      return Weak<T>();
+    }
+
+    /**
+     * @brief Get a Shared pointer on the object in the slot, without going through a Weak copy
+     *
+     * @return Shared<T> empty if the slot is empty or its object expired
+     */
+    Shared<T> lock() const
+    {
+      HazardGuard guard;
+      for (WeakBlockControl *block = m_block.load(std::memory_order_acquire); block;)
+      {
+        WeakBlockControl *current = protect(guard, block);
+        if (current == block)
+        {
+          if (block->tryAddRef())
+          {
+            return Shared<T>(static_cast<T *>(block->address()), block);
+          }
+          if (m_block.load() == block)
+          {
+            break; // Still in the slot, its object expired
+          }
+          current = m_block.load();
+        }
+        block = current;
+      }
+      return Shared<T>();
+    }
+
+    /**
+     * @brief Replace the Weak pointer in the slot
+     */
+    void store(Weak<T> weak)
+    {
+      release(m_block.exchange(take(weak), std::memory_order_acq_rel));
+    }
+
+    /**
+     * @brief Replace the Weak pointer in the slot
+     *
+     * @return Weak<T> the previous one
+     */
+    Weak<T> exchange(Weak<T> weak)
+    {
+      return adoptWeak(m_block.exchange(take(weak), std::memory_order_acq_rel));
+    }
+
+    /**
+     * @brief Replace the Weak pointer in the slot if it still observes the expected object
+     *
+     * @return bool true if it was replaced, otherwise expected is set to the current one
+     */
+    bool compareExchange(Weak<T> &expected, Weak<T> desired)
+    {
+      WeakBlockControl *block = expected.m_block;
+      if (desired.m_block)
+      {
+        desired.m_block->markHazardous(); // Before it can be read from the slot
+      }
+      if (m_block.compare_exchange_strong(block, desired.m_block, std::memory_order_acq_rel))
+      {
+        take(desired);
+        release(block);
+        return true;
+      }
+      expected = load();
+      return false;
+    }
+
+    /**
+     * @brief Check if the slot is empty
+     *
+     * @return bool
+     */
+    bool empty() const
+    {
+      return m_block.load(std::memory_order_acquire) == nullptr;
+    }
+
+  private:
+    std::atomic<WeakBlockControl *> m_block{nullptr};
+
+    /**
+     * @brief Publish a hazard on a block read from the slot, then read the slot again
+     *
+     * @return WeakBlockControl* the block now in the slot, the hazard is only useful if it is the same
+     */
+    WeakBlockControl *protect(HazardGuard &guard, WeakBlockControl *block) const
+    {
+      guard.protectBlock(block);
+      // sequentially consistent with the hazard store, a writer that dropped the block either sees the hazard or its change is seen here
+      return m_block.load();
+    }
+
+    /**
+     * @brief Take over the reference of a Weak pointer, flagging its block for the readers' hazards
+     */
+    static WeakBlockControl *take(Weak<T> &weak)
+    {
+      WeakBlockControl *block = weak.m_block;
+      if (block)
+      {
+        block->markHazardous(); // Sequenced before the slot store that publishes the block
+      }
+      weak.m_ptr = nullptr;
+      weak.m_block = nullptr;
+      return block;
+    }
+
+    /**
+     * @brief Build a Weak pointer adopting a reference already taken on the block
+     */
+    static Weak<T> adoptWeak(WeakBlockControl *block)
+    {
+      Weak<T> weak;
+      if (block)
+      {
+        weak.m_ptr = static_cast<T *>(block->address());
+        weak.m_block = block;
+      }
+      return weak;
+    }
+
+    static void release(WeakBlockControl *block)
+    {
+      if (block && block->releaseWeak())
+      {
+        block->releaseBlock();
+      }
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_ATOMICWEAK_H
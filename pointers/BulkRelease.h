@@ -0,0 +1,354 @@
+#ifndef SP_BULKRELEASE_H
+#define SP_BULKRELEASE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Abi.h"
+#include "Shared.h"
+#include "Vector.h"
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Where releaseAll destroys the objects whose last reference it dropped
+   */
+  enum class Teardown
+  {
+    Inline,     // Before releaseAll returns
+    Background, // On a background thread, wait for them with drainReleases()
+  };
+
+  namespace detail
+  {
+
+    // the thread destroying the objects handed over by releaseAll, started on first use
+    class ReleaseThread
+    {
+    public:
+      static ReleaseThread &instance()
+      {
+        static ReleaseThread thread;
+        return thread;
+      }
+
+      ~ReleaseThread()
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_stop = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+      }
+
+      // the blocks are left to the caller if they cannot be queued
+      void post(std::vector<BlockControl *> &blocks)
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_queue.push_back(std::move(blocks));
+        }
+        m_wake.notify_one();
+      }
+
+      void drain()
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]()
+                    { return m_queue.empty() && !m_busy; });
+      }
+
+    private:
+      std::mutex m_mutex;
+      std::condition_variable m_wake;
+      std::condition_variable m_idle;
+      std::deque<std::vector<BlockControl *>> m_queue;
+      bool m_busy = false;
+      bool m_stop = false;
+      std::thread m_thread{[this]()
+                           { run(); }}; // Last, starts once the other members are built
+
+      ReleaseThread() = default;
+
+      void run();
+    };
+
+    // takes the references out of ranges of Shared pointers, friend of Shared
+    struct BulkRelease
+    {
+      static constexpr std::size_t PrefetchDistance = 8; // Elements ahead whose block is prefetched
+      static constexpr std::size_t DestroyBatch = 64;    // Dead blocks destroyed together while still in cache
+
+      /**
+       * @brief Empty every Shared pointer of a range, site is the caller reported to the profiler
+       *
+       * Runs of pointers on the same block are dropped with a single decrement, after the same
+       * checks and profiling as a single release. The blocks whose count reaches zero are destroyed
+       * by batches, or handed to the release thread. Types whose decrements the thread defers go
+       * through its buffer one pointer at a time.
+       */
+      template <typename Iterator>
+      static void release(Iterator first, Iterator last, Teardown teardown, void *site)
+      {
+        using T = std::remove_pointer_t<decltype(first->m_ptr)>;
+        if constexpr (DeferredTraits<T>::enabled)
+        {
+          if (refBuffer())
+          {
+            for (Iterator it = first; it != last; ++it)
+            {
+              it->releaseResources(site);
+              it->m_block = nullptr;
+              it->m_ptr = nullptr;
+            }
+            return;
+          }
+        }
+        Dead dead(teardown);
+        Iterator ahead = first;
+        for (std::size_t i = 0; i < PrefetchDistance && ahead != last; ++i, ++ahead)
+        {
+          prefetch(ahead->m_block);
+        }
+        BlockControl *run = nullptr;
+        std::size_t runLength = 0;
+        for (Iterator it = first; it != last; ++it)
+        {
+          if (ahead != last)
+          {
+            prefetch(ahead->m_block);
+            ++ahead;
+          }
+          BlockControl *block = it->m_block;
+          if (block != run)
+          {
+            // nothing is pending when a check fails, its handler may throw
+            releaseRun(run, runLength, dead);
+            run = nullptr;
+            runLength = 0;
+            if (block)
+            {
+              SP_CHECK_BLOCK(block, "Shared release");
+            }
+            run = block;
+          }
+          if (block)
+          {
+            SP_PROFILE_COUNT(T, block, site);
+          }
+          it->m_block = nullptr;
+          it->m_ptr = nullptr;
+          ++runLength;
+        }
+        releaseRun(run, runLength, dead);
+      }
+
+      /**
+       * @brief Delete the objects of blocks whose count reached zero
+       */
+      static void destroy(BlockControl *const *dead, std::size_t size)
+      {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+          if (i + PrefetchDistance < size)
+          {
+            prefetch(dead[i + PrefetchDistance]);
+          }
+          dead[i]->releaseObject();
+        }
+      }
+
+    private:
+      // the blocks whose count reached zero, destroyed when the batch is full or gathered for the release thread
+      class Dead
+      {
+      public:
+        explicit Dead(Teardown teardown) : m_background(teardown == Teardown::Background)
+        {
+        }
+
+        // also reached when a failed check throws, the blocks released so far are not leaked
+        ~Dead()
+        {
+          destroy(m_batch, m_size);
+          if (!m_gathered.empty())
+          {
+            try
+            {
+              ReleaseThread::instance().post(m_gathered);
+            }
+            catch (...)
+            {
+              destroy(m_gathered.data(), m_gathered.size());
+            }
+          }
+        }
+
+        Dead(const Dead &) = delete;
+        Dead &operator=(const Dead &) = delete;
+
+        void add(BlockControl *block)
+        {
+          if (m_background)
+          {
+            try
+            {
+              m_gathered.push_back(block);
+              return;
+            }
+            catch (const std::bad_alloc &)
+            {
+              m_background = false; // Out of memory, the next blocks are destroyed inline
+            }
+          }
+          m_batch[m_size++] = block;
+          if (m_size == DestroyBatch)
+          {
+            destroy(m_batch, m_size);
+            m_size = 0;
+          }
+        }
+
+      private:
+        bool m_background;
+        BlockControl *m_batch[DestroyBatch];
+        std::size_t m_size = 0;
+        std::vector<BlockControl *> m_gathered;
+      };
+
+      static void prefetch(const BlockControl *block)
+      {
+        if (block)
+        {
+          __builtin_prefetch(block, 1); // Written by the decrement
+        }
+      }
+
+      static void releaseRun(BlockControl *block, std::size_t count, Dead &dead)
+      {
+        if (block && block->releaseRef(count))
+        {
+          dead.add(block);
+        }
+      }
+    };
+
+    inline void ReleaseThread::run()
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (true)
+      {
+        m_wake.wait(lock, [this]()
+                    { return m_stop || !m_queue.empty(); });
+        if (m_queue.empty())
+        {
+          return; // Stopping, and nothing left to destroy
+        }
+        std::vector<BlockControl *> blocks = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_busy = true;
+        lock.unlock();
+        BulkRelease::destroy(blocks.data(), blocks.size());
+        lock.lock();
+        m_busy = false;
+        m_idle.notify_all();
+      }
+    }
+
+  } // namespace detail
+
+  /**
+   * @brief Empty every Shared pointer of a range, faster than destroying them one at a time
+   *
+   * The control blocks are prefetched a few elements ahead and consecutive pointers on the same
+   * block are released with one decrement. The objects whose count reaches zero are deleted in
+   * small batches while their blocks are still in cache, without allocating, or all of them on a
+   * background thread, in which case their destructors must not depend on the calling thread.
+   * The background teardown falls back to the inline one when memory runs out.
+   *
+   * @note usage example: sp::releaseAll(vectorOfShared);
+   */
+  template <typename Range>
+  SP_CALLER_ENTRY void releaseAll(Range &range, Teardown teardown = Teardown::Inline)
+  {
+    detail::BulkRelease::release(std::begin(range), std::end(range), teardown, SP_CALLER);
+  }
+
+  /**
+   * @brief Wait until the background thread has deleted every object handed over by releaseAll
+   */
+  inline void drainReleases()
+  {
+    detail::ReleaseThread::instance().drain();
+  }
+
+  /**
+   * @brief Vector of Shared pointers that releases its elements in bulk
+   *
+   * Destruction, clear() and assignment go through releaseAll instead of destroying the elements
+   * one at a time.
+   */
+  template <typename T>
+  class SharedVector : public Vector<Shared<T>>
+  {
+    using Base = Vector<Shared<T>>;
+
+  public:
+    SharedVector() = default;
+    SharedVector(const SharedVector &) = default;
+    SharedVector(SharedVector &&) noexcept = default;
+
+    SP_CALLER_ENTRY ~SharedVector()
+    {
+      release(Teardown::Inline, SP_CALLER);
+    }
+
+    SP_CALLER_ENTRY SharedVector &operator=(const SharedVector &other)
+    {
+      if (this != &other)
+      {
+        release(Teardown::Inline, SP_CALLER);
+        Base::operator=(other);
+      }
+      return *this;
+    }
+
+    SP_CALLER_ENTRY SharedVector &operator=(SharedVector &&other) noexcept
+    {
+      if (this != &other)
+      {
+        release(Teardown::Inline, SP_CALLER);
+        Base::operator=(std::move(other));
+      }
+      return *this;
+    }
+
+    /**
+     * @brief Release every element, the capacity is kept
+     */
+    SP_CALLER_ENTRY void clear(Teardown teardown = Teardown::Inline)
+    {
+      release(teardown, SP_CALLER);
+      Base::clear();
+    }
+
+  private:
+    // the inline teardown never allocates, the destructor and the move assignment cannot throw
+    void release(Teardown teardown, void *site)
+    {
+      detail::BulkRelease::release(this->begin(), this->end(), teardown, site);
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_BULKRELEASE_H
@@ -0,0 +1,367 @@
+#ifndef SP_CHANNEL_H
+#define SP_CHANNEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "Abi.h"
+#include "Futex.h"
+#include "Unique.h"
+
+SP_BEGIN_NAMESPACE
+
+  template <typename Item>
+  class Channel;
+
+  namespace detail
+  {
+
+    // threads sleeping until the other side of a channel makes progress
+    // the futex word is an epoch shifted left by one, the low bit is set while threads sleep on it
+    struct alignas(64) ChannelParking
+    {
+      std::atomic<int> word{0};
+
+      /**
+       * @brief Sleep until a notification, unless the condition already holds
+       */
+      template <typename Condition>
+      void wait(Condition condition)
+      {
+        int seen = word.fetch_or(1) | 1; // Sequentially consistent, ordered before the check below
+        if (!condition())
+        {
+          futexWait(word, seen);
+        }
+      }
+
+      /**
+       * @brief Wake the sleeping threads, only the first notification after they slept pays a system call
+       */
+      void notify()
+      {
+        // pairs with the bit set by wait: either the waiter sees our progress or we see the bit
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int current = word.load(std::memory_order_relaxed);
+        // clearing the bit moves to the next epoch, if the exchange fails another thread did it
+        if ((current & 1) && word.compare_exchange_strong(current, static_cast<int>(static_cast<unsigned>(current) + 1), std::memory_order_relaxed))
+        {
+          futexWake(word);
+        }
+      }
+    };
+
+  } // namespace detail
+
+  /**
+   * @brief Bounded multi-producer multi-consumer channel of Unique pointers
+   *
+   * A lock-free ring of raw pointers (Vyukov's bounded queue): each cell has a sequence number
+   * telling whether it is free or full for the current lap, so producers and consumers only
+   * contend on their own position counter. Ownership moves into the channel on push and out of
+   * it on pop, nothing is allocated after construction. Blocked threads sleep on a futex, the
+   * other side only makes a system call if one is sleeping. Items still queued are deleted with
+   * the channel. Closing sets the top bit of the push counter, so a push either claims its cells
+   * before the close or fails, and consumers know exactly which cells are still to come.
+   */
+  template <typename T>
+  class Channel<Unique<T>>
+  {
+  public:
+    /**
+     * @brief Constructor takes the capacity, rounded up to a power of two
+     */
+    explicit Channel(std::size_t capacity)
+    {
+      if (capacity == 0)
+      {
+        throw std::invalid_argument("Channel capacity must not be zero");
+      }
+      std::size_t size = 1;
+      while (size < capacity)
+      {
+        size *= 2;
+      }
+      m_mask = size - 1;
+      m_cells.reset(new Cell[size]);
+      for (std::size_t i = 0; i < size; ++i)
+      {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    /**
+     * @brief Destructor deletes the items still queued
+     */
+    ~Channel()
+    {
+      while (tryPop())
+      {
+      }
+    }
+
+    // Non-copyable
+    Channel(const Channel &) = delete;
+    Channel &operator=(const Channel &) = delete;
+
+    /**
+     * @brief Get the number of items the channel holds at most
+     */
+    std::size_t capacity() const
+    {
+      return m_mask + 1;
+    }
+
+    /**
+     * @brief Push an item if there is room
+     *
+     * @return bool true if the item moved into the channel, otherwise it is left to the caller
+     */
+    bool tryPush(Unique<T> &&item)
+    {
+      return tryPushBatch(&item, 1) == 1;
+    }
+
+    /**
+     * @brief Push an item, sleeping while the channel is full
+     *
+     * @return bool false if the channel is closed, the item is then left to the caller
+     */
+    bool push(Unique<T> &&item)
+    {
+      return pushBatch(&item, 1) == 1;
+    }
+
+    /**
+     * @brief Pop an item if there is one
+     *
+     * @return Unique<T> empty if the channel is empty
+     */
+    Unique<T> tryPop()
+    {
+      Unique<T> item;
+      tryPopBatch(&item, 1);
+      return item;
+    }
+
+    /**
+     * @brief Pop an item, sleeping while the channel is empty
+     *
+     * @return Unique<T> empty only once the channel is closed and drained
+     */
+    Unique<T> pop()
+    {
+      Unique<T> item;
+      popBatch(&item, 1);
+      return item;
+    }
+
+    /**
+     * @brief Push as many items as there is room for, with a single claim on the ring
+     *
+     * @return std::size_t the number of items moved into the channel, from the first one, zero if it is closed
+     */
+    std::size_t tryPushBatch(Unique<T> *items, std::size_t count)
+    {
+      std::size_t position;
+      std::size_t claimed = claim(m_pushPosition, 0, count, position);
+      for (std::size_t i = 0; i < claimed; ++i)
+      {
+        Cell &cell = m_cells[(position + i) & m_mask];
+        cell.value = items[i].release();
+        cell.sequence.store(position + i + 1, std::memory_order_release);
+      }
+      if (claimed != 0)
+      {
+        m_notEmpty.notify();
+      }
+      return claimed;
+    }
+
+    /**
+     * @brief Push every item, sleeping while the channel is full
+     *
+     * @return std::size_t the number of items moved into the channel, less than count only if it is closed
+     */
+    std::size_t pushBatch(Unique<T> *items, std::size_t count)
+    {
+      std::size_t pushed = 0;
+      while (pushed < count && !closed())
+      {
+        std::size_t done = tryPushBatch(items + pushed, count - pushed);
+        pushed += done;
+        if (done == 0 && !spin([this]()
+                               { return hasRoom(); }))
+        {
+          m_notFull.wait([this]()
+                         { return hasRoom() || closed(); });
+        }
+      }
+      return pushed;
+    }
+
+    /**
+     * @brief Pop as many items as available, up to the given number, with a single claim on the ring
+     *
+     * @return std::size_t the number of items written to the array
+     */
+    std::size_t tryPopBatch(Unique<T> *items, std::size_t count)
+    {
+      std::size_t position;
+      std::size_t claimed = claim(m_popPosition, 1, count, position);
+      for (std::size_t i = 0; i < claimed; ++i)
+      {
+        Cell &cell = m_cells[(position + i) & m_mask];
+        items[i] = Unique<T>(cell.value);
+        cell.sequence.store(position + i + m_mask + 1, std::memory_order_release);
+      }
+      if (claimed != 0)
+      {
+        m_notFull.notify();
+      }
+      return claimed;
+    }
+
+    /**
+     * @brief Pop at least one item, up to the given number, sleeping while the channel is empty
+     *
+     * @return std::size_t the number of items written to the array, zero only once the channel is closed and drained
+     */
+    std::size_t popBatch(Unique<T> *items, std::size_t count)
+    {
+      while (true)
+      {
+        if (std::size_t popped = tryPopBatch(items, count))
+        {
+          return popped;
+        }
+        if (std::size_t pushed = m_pushPosition.load(std::memory_order_acquire); pushed & ClosedBit)
+        {
+          // the cells claimed before the close may not be published yet, wait until they are popped
+          while (m_popPosition.load(std::memory_order_acquire) != (pushed & ~ClosedBit))
+          {
+            if (std::size_t popped = tryPopBatch(items, count))
+            {
+              return popped;
+            }
+            std::this_thread::yield();
+          }
+          return 0;
+        }
+        if (!spin([this]()
+                  { return hasItem(); }))
+        {
+          m_notEmpty.wait([this]()
+                          { return hasItem() || closed(); });
+        }
+      }
+    }
+
+    /**
+     * @brief Close the channel, pushes fail and pops return empty once the queued items are gone
+     */
+    void close()
+    {
+      m_pushPosition.fetch_or(ClosedBit);
+      m_notEmpty.notify();
+      m_notFull.notify();
+    }
+
+    /**
+     * @brief Check if the channel is closed
+     */
+    bool closed() const
+    {
+      return m_pushPosition.load(std::memory_order_acquire) & ClosedBit;
+    }
+
+  private:
+    static constexpr int SpinCount = 64;                                              // Checks before sleeping
+    static constexpr std::size_t ClosedBit = ~(static_cast<std::size_t>(-1) >> 1); // Set in the push counter by close()
+
+    struct Cell
+    {
+      std::atomic<std::size_t> sequence; // Position + offset when the cell is ready for that position
+      T *value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::size_t m_mask;
+    alignas(64) std::atomic<std::size_t> m_pushPosition{0}; // Top bit set once closed
+    alignas(64) std::atomic<std::size_t> m_popPosition{0};
+    detail::ChannelParking m_notEmpty;
+    detail::ChannelParking m_notFull;
+
+    /**
+     * @brief Claim up to count consecutive cells ready at a position counter
+     *
+     * A cell is ready when its sequence is its position plus the offset: 0 for producers, 1 for
+     * consumers. The cells are checked first, then taken with one CAS on the counter, which fails
+     * once the closed bit is set in the push counter.
+     *
+     * @return std::size_t the number of cells claimed, starting at position
+     */
+    std::size_t claim(std::atomic<std::size_t> &counter, std::size_t offset, std::size_t count, std::size_t &position)
+    {
+      position = counter.load(std::memory_order_relaxed);
+      while (true)
+      {
+        if (position & ClosedBit)
+        {
+          return 0;
+        }
+        std::size_t ready = 0;
+        while (ready < count &&
+               m_cells[(position + ready) & m_mask].sequence.load(std::memory_order_acquire) == position + ready + offset)
+        {
+          ++ready;
+        }
+        if (ready == 0)
+        {
+          std::size_t sequence = m_cells[position & m_mask].sequence.load(std::memory_order_acquire);
+          if (static_cast<std::ptrdiff_t>(sequence - (position + offset)) < 0)
+          {
+            return 0; // Full for producers, empty for consumers
+          }
+          position = counter.load(std::memory_order_relaxed); // Another thread claimed it, try again
+          continue;
+        }
+        if (counter.compare_exchange_weak(position, position + ready, std::memory_order_relaxed))
+        {
+          return ready;
+        }
+      }
+    }
+
+    bool hasRoom() const
+    {
+      std::size_t position = m_pushPosition.load(std::memory_order_relaxed);
+      return m_cells[position & m_mask].sequence.load(std::memory_order_acquire) == position;
+    }
+
+    bool hasItem() const
+    {
+      std::size_t position = m_popPosition.load(std::memory_order_relaxed);
+      return m_cells[position & m_mask].sequence.load(std::memory_order_acquire) == position + 1;
+    }
+
+    template <typename Condition>
+    static bool spin(Condition condition)
+    {
+      for (int i = 0; i < SpinCount; ++i)
+      {
+        if (condition())
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_CHANNEL_H
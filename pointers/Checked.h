@@ -0,0 +1,159 @@
+#ifndef SP_CHECKED_H
+#define SP_CHECKED_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "Abi.h"
+
+/**
+ * Built-in checking mode, compiled in when SP_CHECKED is defined before the first include of
+ * Shared.h. Control blocks carry a magic value that is poisoned with their counts when they are
+ * deleted, and their memory stays in a small per-thread quarantine for a while. Copies, releases,
+ * lock() and dereferences check the magic first, so a use after free or a double release through a
+ * stale handle is reported instead of corrupting a reused block. Cheap enough for canaries, it
+ * does not replace a sanitizer build for the rest of the program.
+ */
+
+// hook of the Shared and Weak paths, checks a control block before it is used
+#define SP_CHECK_BLOCK(block, operation) ::sp::detail::checkBlock(block, operation)
+
+SP_BEGIN_NAMESPACE
+  namespace detail
+  {
+
+    constexpr std::uint32_t BlockAlive = 0x53504c4b;                                             // Live control block
+    constexpr std::uint32_t BlockFreed = 0xdeadb10c;                                             // Deleted control block
+    constexpr std::size_t PoisonedCount = static_cast<std::size_t>(0xdeaddeaddeaddeadULL); // Counts of a deleted block
+
+    using CheckFailureHandler = void (*)(const char *message);
+
+    inline CheckFailureHandler &checkFailureHandler()
+    {
+      static CheckFailureHandler handler = nullptr;
+      return handler;
+    }
+
+    /**
+     * @brief Report a failed check, aborts unless a handler was installed
+     */
+    [[gnu::noinline, gnu::cold]] inline void checkFailed(const char *message)
+    {
+      if (CheckFailureHandler handler = checkFailureHandler())
+      {
+        handler(message);
+        return;
+      }
+      std::fprintf(stderr, "sp: %s\n", message);
+      std::abort();
+    }
+
+    /**
+     * @brief Check that a control block is alive
+     */
+    template <typename Block>
+    inline void checkBlock(const Block *block, const char *operation)
+    {
+      std::uint32_t magic = *static_cast<const volatile std::uint32_t *>(&block->checkMagic);
+      if (__builtin_expect(magic != BlockAlive, 0))
+      {
+        char message[160];
+        std::snprintf(message, sizeof(message), "%s through a handle on a %s control block %p", operation,
+                      magic == BlockFreed ? "deleted" : "corrupted", static_cast<const void *>(block));
+        checkFailed(message);
+      }
+    }
+
+    // blocks recently deleted by the current thread, freed once the ring wraps around
+    class Quarantine
+    {
+    public:
+      static constexpr std::size_t Capacity = 256;
+
+      ~Quarantine()
+      {
+        for (Entry &entry : m_entries)
+        {
+          free(entry);
+        }
+        alive() = false;
+      }
+
+      // false once the thread-local quarantine is destroyed, blocks deleted later are freed right away
+      static bool &alive()
+      {
+        static thread_local bool alive = true;
+        return alive;
+      }
+
+      void add(void *memory, std::size_t align)
+      {
+        Entry &entry = m_entries[m_next];
+        free(entry);
+        entry = {memory, align};
+        m_next = (m_next + 1) % Capacity;
+      }
+
+      static void free(void *memory, std::size_t align)
+      {
+        if (align)
+        {
+          ::operator delete(memory, std::align_val_t(align));
+        }
+        else
+        {
+          ::operator delete(memory);
+        }
+      }
+
+    private:
+      struct Entry
+      {
+        void *memory;
+        std::size_t align;
+      };
+
+      Entry m_entries[Capacity] = {};
+      std::size_t m_next = 0;
+
+      static void free(Entry &entry)
+      {
+        if (entry.memory)
+        {
+          free(entry.memory, entry.align);
+        }
+      }
+    };
+
+    /**
+     * @brief Keep the memory of a deleted block for a while instead of freeing it
+     */
+    inline void quarantineBlock(void *memory, std::size_t align)
+    {
+      if (!Quarantine::alive())
+      {
+        Quarantine::free(memory, align);
+        return;
+      }
+      static thread_local Quarantine quarantine;
+      quarantine.add(memory, align);
+    }
+
+  } // namespace detail
+
+  /**
+   * @brief Replace the abort of a failed check, for example to log and keep serving
+   *
+   * The handler may throw to leave the failing operation, except from a destructor.
+   */
+  inline void setCheckFailureHandler(void (*handler)(const char *message))
+  {
+    detail::checkFailureHandler() = handler;
+  }
+
+SP_END_NAMESPACE
+
+#endif // SP_CHECKED_H
@@ -0,0 +1,347 @@
+#ifndef SP_CONTENTION_H
+#define SP_CONTENTION_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <csignal>
+#include <unistd.h>
+
+#include "Abi.h"
+#include "Demangle.h"
+
+/**
+ * Sampling profiler of the Shared count updates, compiled in when SP_PROFILE_CONTENTION is defined
+ * before the first include of Shared.h. Sampling is off until ContentionProfiler::start() is
+ * called; while it is off a count update costs one relaxed load more and never allocates. The
+ * Shared entry points that update a count are then not inlined, their return address is the
+ * call site reported for each update.
+ */
+
+// hook of the Shared count paths, the type is only named on sampled updates
+#define SP_PROFILE_COUNT(T, block, site) ::sp::detail::profileCount(block, typeid(T), site)
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief A control block seen by the profiler, with its sampled count updates
+   */
+  struct HotBlock
+  {
+    const void *block;                                   // Control block address, may have been reused by a later block
+    std::string type;                                    // Demangled type of the managed object
+    std::uint64_t samples;                               // Sampled count updates
+    std::size_t threads;                                 // Threads that updated the count
+    std::vector<std::pair<void *, std::uint64_t>> sites; // Call sites by decreasing samples
+  };
+
+  namespace detail
+  {
+
+    // the sampled updates of every block, sharded by block address so that threads on different blocks rarely share a lock
+    class ContentionRegistry
+    {
+    public:
+      static constexpr std::size_t Shards = 16;
+
+      static ContentionRegistry &instance()
+      {
+        static ContentionRegistry registry;
+        return registry;
+      }
+
+      std::atomic<std::uint32_t> period{0}; // One update sampled in period, zero when off
+
+      void record(const void *block, const std::type_info &type, void *site, std::uint32_t thread)
+      {
+        Shard &shard = m_shards[shardIndex(block)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Entry &entry = shard.entries[block];
+        if (entry.type != &type)
+        {
+          entry = Entry(); // The address now belongs to a block of another type
+          entry.type = &type;
+        }
+        ++entry.samples;
+        ++entry.threads[thread];
+        ++entry.sites[site];
+      }
+
+      std::vector<HotBlock> top(std::size_t count)
+      {
+        std::vector<HotBlock> blocks;
+        for (Shard &shard : m_shards)
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          for (const auto &entry : shard.entries)
+          {
+            HotBlock hot{entry.first, demangle(entry.second.type->name()), entry.second.samples,
+                         entry.second.threads.size(), {entry.second.sites.begin(), entry.second.sites.end()}};
+            std::sort(hot.sites.begin(), hot.sites.end(), [](const auto &a, const auto &b)
+                      { return a.second > b.second; });
+            blocks.push_back(std::move(hot));
+          }
+        }
+        std::sort(blocks.begin(), blocks.end(), [](const HotBlock &a, const HotBlock &b)
+                  { return a.samples > b.samples || (a.samples == b.samples && a.threads > b.threads); });
+        if (blocks.size() > count)
+        {
+          blocks.resize(count);
+        }
+        return blocks;
+      }
+
+      void clear()
+      {
+        for (Shard &shard : m_shards)
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          shard.entries.clear();
+        }
+      }
+
+    private:
+      struct Entry
+      {
+        const std::type_info *type = nullptr;
+        std::uint64_t samples = 0;
+        std::unordered_map<std::uint32_t, std::uint64_t> threads;
+        std::unordered_map<void *, std::uint64_t> sites;
+      };
+
+      struct alignas(64) Shard
+      {
+        std::mutex mutex;
+        std::unordered_map<const void *, Entry> entries;
+      };
+
+      Shard m_shards[Shards];
+
+      static std::size_t shardIndex(const void *block)
+      {
+        return (reinterpret_cast<std::uintptr_t>(block) >> 6) % Shards;
+      }
+    };
+
+    // small dense index of the current thread, cheaper to store than a std::thread::id
+    inline std::uint32_t profileThread()
+    {
+      static std::atomic<std::uint32_t> next{0};
+      static thread_local std::uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+      return index;
+    }
+
+    /**
+     * @brief Count an update of a block, and record one every period updates of the thread
+     */
+    inline void profileCount(const void *block, const std::type_info &type, void *site)
+    {
+      static thread_local std::uint32_t countdown = 1;
+      ContentionRegistry &registry = ContentionRegistry::instance();
+      std::uint32_t period = registry.period.load(std::memory_order_relaxed);
+      if (period != 0 && --countdown == 0)
+      {
+        countdown = period;
+        registry.record(block, type, site, profileThread());
+      }
+    }
+
+    // the dump on signal in place: the self-pipe its handler writes to, the handler it replaced and the dumper thread
+    struct ProfileSignal
+    {
+      std::mutex mutex;
+      std::atomic<int> pipe{-1}; // End the handler writes to, -1 when no dump is installed
+      int readEnd = -1;
+      int signal = 0;
+      struct sigaction previous = {};
+      std::thread dumper;
+
+      ~ProfileSignal()
+      {
+        uninstall(); // A joinable thread must not outlive the process statics
+      }
+
+      bool uninstall()
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pipe.load() == -1)
+        {
+          return false;
+        }
+        sigaction(signal, &previous, nullptr);
+        close(pipe.exchange(-1)); // The dumper reads the end of the pipe and returns
+        dumper.join();
+        close(readEnd);
+        readEnd = -1;
+        return true;
+      }
+    };
+
+    inline ProfileSignal &profileSignal()
+    {
+      static ProfileSignal installed;
+      return installed;
+    }
+
+  } // namespace detail
+
+  /**
+   * @brief Control of the Shared contention profiler
+   */
+  class ContentionProfiler
+  {
+  public:
+    /**
+     * @brief Start sampling one count update in period on each thread
+     */
+    static void start(std::uint32_t period = 64)
+    {
+      detail::ContentionRegistry::instance().period.store(std::max<std::uint32_t>(period, 1), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Stop sampling, the samples taken so far are kept
+     */
+    static void stop()
+    {
+      detail::ContentionRegistry::instance().period.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Check if sampling is on
+     */
+    static bool running()
+    {
+      return detail::ContentionRegistry::instance().period.load(std::memory_order_relaxed) != 0;
+    }
+
+    /**
+     * @brief Drop every sample
+     */
+    static void clear()
+    {
+      detail::ContentionRegistry::instance().clear();
+    }
+
+    /**
+     * @brief Get the blocks with the most sampled updates
+     *
+     * @return std::vector<HotBlock> hottest first
+     */
+    static std::vector<HotBlock> top(std::size_t count = 20)
+    {
+      return detail::ContentionRegistry::instance().top(count);
+    }
+
+    /**
+     * @brief Write the hottest blocks to a file
+     *
+     * Call sites are raw return addresses, to resolve with addr2line or a debugger.
+     *
+     * @return bool false if the file could not be written
+     */
+    static bool dump(const std::string &path, std::size_t count = 20)
+    {
+      std::FILE *file = std::fopen(path.c_str(), "w");
+      if (!file)
+      {
+        return false;
+      }
+      std::fprintf(file, "# samples threads block type\n");
+      for (const HotBlock &hot : top(count))
+      {
+        std::fprintf(file, "%llu %zu %p %s\n", static_cast<unsigned long long>(hot.samples), hot.threads, hot.block, hot.type.c_str());
+        for (const auto &site : hot.sites)
+        {
+          std::fprintf(file, "  %llu %p\n", static_cast<unsigned long long>(site.second), site.first);
+        }
+      }
+      return std::fclose(file) == 0;
+    }
+
+    /**
+     * @brief Dump the hottest blocks to a file each time the process receives a signal
+     *
+     * The handler only writes to a pipe, a thread started here does the dump. Only one dump is
+     * installed at a time, stopDumpOnSignal() removes it.
+     *
+     * @return bool false if a dump is already installed, or the pipe or the handler could not be set up
+     */
+    static bool dumpOnSignal(int signal, std::string path, std::size_t count = 20)
+    {
+      detail::ProfileSignal &installed = detail::profileSignal();
+      std::lock_guard<std::mutex> lock(installed.mutex);
+      int fds[2];
+      if (installed.pipe.load() != -1 || pipe(fds) != 0)
+      {
+        return false;
+      }
+      installed.pipe.store(fds[1]);
+      struct sigaction action = {};
+      action.sa_handler = [](int)
+      {
+        int saved = errno;
+        char byte = 0;
+        ssize_t written = write(detail::profileSignal().pipe.load(std::memory_order_relaxed), &byte, 1);
+        (void)written;
+        errno = saved;
+      };
+      sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_RESTART;
+      if (sigaction(signal, &action, &installed.previous) != 0)
+      {
+        installed.pipe.store(-1);
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+      }
+      try
+      {
+        installed.dumper = std::thread([fd = fds[0], path = std::move(path), count]()
+                                       {
+          char byte;
+          while (read(fd, &byte, 1) == 1)
+          {
+            dump(path, count);
+          } });
+      }
+      catch (...)
+      {
+        sigaction(signal, &installed.previous, nullptr);
+        installed.pipe.store(-1);
+        close(fds[0]);
+        close(fds[1]);
+        throw;
+      }
+      installed.signal = signal;
+      installed.readEnd = fds[0];
+      return true;
+    }
+
+    /**
+     * @brief Remove the dump installed by dumpOnSignal(), the handler it replaced is restored
+     *
+     * @return bool false if no dump was installed
+     */
+    static bool stopDumpOnSignal()
+    {
+      return detail::profileSignal().uninstall();
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_CONTENTION_H
@@ -0,0 +1,145 @@
+#ifndef SP_COW_H
+#define SP_COW_H
+
+#include <utility>
+#include <stdexcept>
+
+#include "Abi.h"
+#include "Shared.h"
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Copy-on-write value wrapper
+   *
+   * Copies share the same storage through a Shared pointer. The value is only
+   * cloned when it is accessed mutably while other copies still hold it.
+   *
+   * The storage is only ever created by makeCow and never handed out as a Shared or Weak
+   * pointer, so the copies of a Cow are its only owners.
+   */
+  template <typename T>
+  class Cow
+  {
+  public:
+    /**
+     * @brief Default constructor, no value
+     */
+    Cow() = default;
+
+    /**
+     * @brief Get a read-only reference on the value
+     *
+     * @return const T&
+     */
+    const T &get() const
+    {
+      return *m_shared;
+    }
+
+    /**
+     * @brief Get a read-only reference on the value
+     *
+     * @return const T&
+     */
+    const T &operator*() const
+    {
+      return *m_shared;
+    }
+
+    /**
+     * @brief Get a read-only raw pointer on the value
+     *
+     * @return const T*
+     */
+    const T *operator->() const
+    {
+      return m_shared.get();
+    }
+
+    /**
+     * @brief Get a mutable reference on the value, cloning it first if it is shared
+     *
+     * @note the storage has no owner but the copies of this Cow, so seeing 1 here means no other
+     * copy exists and none can appear while this one is being mutated
+     *
+     * @return T&
+     */
+    T &mut()
+    {
+      if (!m_shared)
+      {
+        throw std::runtime_error("Null pointer exception");
+      }
+      if (m_shared.count() > 1)
+      {
+        m_shared = Shared<T>::makeShared(*m_shared);
+      }
+      return *m_shared;
+    }
+
+    /**
+     * @brief Check if this copy is the only owner of its storage
+     *
+     * @return bool
+     */
+    bool unique() const
+    {
+      return m_shared.count() == 1;
+    }
+
+    /**
+     * @brief Get the number of copies sharing the storage
+     *
+     * @return std::size_t
+     */
+    std::size_t count() const
+    {
+      return m_shared.count();
+    }
+
+    /**
+     * @brief Check if a value exists
+     *
+     * @return bool
+     */
+    bool exists() const
+    {
+      return m_shared.exists();
+    }
+
+    /**
+     * @brief Check if a value exists
+     *
+     * @return bool
+     */
+    operator bool() const
+    {
+      return exists();
+    }
+
+    /**
+     * @brief make a copy-on-write value
+     *
+     * @note usage example: sp::Cow<T> cow = sp::Cow<T>::makeCow(args...);
+     */
+    template <typename... Args>
+    static Cow makeCow(Args &&...args)
+    {
+      return Cow(Shared<T>::makeShared(std::forward<Args>(args)...));
+    }
+
+  private:
+    Shared<T> m_shared;
+
+    /**
+     * @brief Private constructor, adopts storage nothing else references
+     */
+    explicit Cow(Shared<T> shared) : m_shared(std::move(shared))
+    {
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_COW_H
@@ -0,0 +1,68 @@
+#ifndef SP_DEFERRED_H
+#define SP_DEFERRED_H
+
+#include "Abi.h"
+#include "Shared.h"
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Scope in which the current thread batches its Shared count updates
+   *
+   * Only the Shared pointers on types opted in with DeferredTraits are batched, the others keep
+   * updating their count right away. Decrements are logged in a thread-local buffer and applied
+   * when the buffer is full, on flush() or when the scope ends. An increment on a block with a
+   * pending decrement cancels it instead of touching the count. Objects are only deleted once a
+   * flush brings their count to zero, so count() may be higher than the number of live Shared
+   * pointers inside the scope. Nested scopes share the buffer of the outermost one.
+   */
+  class DeferredCounts
+  {
+  public:
+    DeferredCounts() : m_outer(detail::refBuffer() == nullptr)
+    {
+      if (m_outer)
+      {
+        detail::refBuffer() = &m_buffer;
+      }
+    }
+
+    ~DeferredCounts()
+    {
+      if (m_outer)
+      {
+        flush();
+        detail::refBuffer() = nullptr;
+      }
+    }
+
+    // Non-copyable
+    DeferredCounts(const DeferredCounts &) = delete;
+    DeferredCounts &operator=(const DeferredCounts &) = delete;
+
+    /**
+     * @brief Apply every pending decrement of the current thread
+     */
+    void flush()
+    {
+      detail::refBuffer()->flush();
+    }
+
+    /**
+     * @brief Get the number of blocks with pending decrements
+     *
+     * @return std::size_t
+     */
+    std::size_t pending() const
+    {
+      return detail::refBuffer()->size;
+    }
+
+  private:
+    detail::RefBuffer m_buffer;
+    bool m_outer; // Installed the buffer and flushes it at the end
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_DEFERRED_H
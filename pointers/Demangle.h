@@ -0,0 +1,29 @@
+#ifndef SP_DEMANGLE_H
+#define SP_DEMANGLE_H
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <cxxabi.h>
+
+#include "Abi.h"
+
+SP_BEGIN_NAMESPACE
+  namespace detail
+  {
+
+    /**
+     * @brief Get the readable name of a mangled type name, or the name itself if it cannot be demangled
+     */
+    inline std::string demangle(const char *name)
+    {
+      int status = 0;
+      std::unique_ptr<char, void (*)(void *)> demangled(abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free);
+      return status == 0 ? demangled.get() : name;
+    }
+
+  } // namespace detail
+SP_END_NAMESPACE
+
+#endif // SP_DEMANGLE_H
@@ -0,0 +1,38 @@
+#ifndef SP_FUTEX_H
+#define SP_FUTEX_H
+
+#include <atomic>
+#include <climits>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Abi.h"
+
+SP_BEGIN_NAMESPACE
+  namespace detail
+  {
+
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex words must be plain ints");
+
+    /**
+     * @brief Sleep while a word holds the expected value, may return spuriously
+     */
+    inline void futexWait(std::atomic<int> &word, int expected)
+    {
+      syscall(SYS_futex, reinterpret_cast<int *>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+    }
+
+    /**
+     * @brief Wake up to the given number of threads sleeping on a word
+     */
+    inline void futexWake(std::atomic<int> &word, int count = INT_MAX)
+    {
+      syscall(SYS_futex, reinterpret_cast<int *>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+
+  } // namespace detail
+SP_END_NAMESPACE
+
+#endif // SP_FUTEX_H
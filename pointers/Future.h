@@ -0,0 +1,527 @@
+#ifndef SP_FUTURE_H
+#define SP_FUTURE_H
+
+#include <atomic>
+#include <exception>
+#include <future>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif // __cpp_impl_coroutine
+
+#include "Abi.h"
+#include "Futex.h"
+#include "Shared.h"
+
+SP_BEGIN_NAMESPACE
+
+  template <typename T>
+  class Future;
+
+  namespace detail
+  {
+
+    /**
+     * @brief Shared state of a Promise and its Future, one control block holding everything
+     *
+     * The block holds the reference count, the status word, the result and the continuation slot.
+     * The status moves from Pending to Ready, through Waiting if a continuation was installed first
+     * or Blocked if a thread sleeps on it. Every transition is a single atomic operation. The result
+     * is stored first, then published: continuations run from the noexcept publish(), an exception
+     * escaping one terminates.
+     */
+    template <typename T>
+    class FutureState : public BlockControl
+    {
+    public:
+      enum Status : int
+      {
+        Pending, // No result, nobody waiting
+        Waiting, // No result, a continuation is installed
+        Blocked, // No result, a thread sleeps on the status
+        Ready,   // Result or exception set
+      };
+
+      using Continuation = void (*)(void *context) noexcept;
+
+      /**
+       * @brief Construct the result, not visible until published
+       */
+      template <typename... Args>
+      void store(Args &&...args)
+      {
+        new (m_storage) T(std::forward<Args>(args)...);
+        m_hasValue = true;
+      }
+
+      /**
+       * @brief Store an exception, not visible until published
+       */
+      void storeException(std::exception_ptr error) noexcept
+      {
+        m_error = std::move(error);
+      }
+
+      /**
+       * @brief Make the stored result visible and run the continuation, if any, on the calling thread
+       */
+      void publish() noexcept
+      {
+        int previous = m_status.exchange(Ready, std::memory_order_acq_rel);
+        if (previous == Waiting)
+        {
+          m_continuation(m_context);
+        }
+        else if (previous == Blocked)
+        {
+          futexWake(m_status);
+        }
+      }
+
+      bool ready() const
+      {
+        return m_status.load(std::memory_order_acquire) == Ready;
+      }
+
+      /**
+       * @brief Sleep until the result is set
+       */
+      void wait()
+      {
+        int status = m_status.load(std::memory_order_acquire);
+        if (status == Pending)
+        {
+          m_status.compare_exchange_strong(status, Blocked, std::memory_order_acq_rel);
+          status = m_status.load(std::memory_order_acquire);
+        }
+        while (status != Ready)
+        {
+          futexWait(m_status, status);
+          status = m_status.load(std::memory_order_acquire);
+        }
+      }
+
+      /**
+       * @brief Install the continuation, run by the thread that sets the result
+       *
+       * @return bool false if the result is already set, the continuation is then not installed
+       */
+      bool onReady(Continuation continuation, void *context)
+      {
+        m_continuation = continuation;
+        m_context = context;
+        int status = Pending;
+        // release so that the producer sees the continuation once it sees Waiting
+        return m_status.compare_exchange_strong(status, Waiting, std::memory_order_acq_rel);
+      }
+
+      /**
+       * @brief Move the result out, or rethrow the exception
+       */
+      T take()
+      {
+        if (m_error)
+        {
+          std::rethrow_exception(m_error);
+        }
+        return std::move(*value());
+      }
+
+      std::exception_ptr error() const
+      {
+        return m_error;
+      }
+
+      void dispose() override
+      {
+        if (m_hasValue)
+        {
+          value()->~T();
+          m_hasValue = false;
+        }
+        m_error = nullptr;
+      }
+
+      void *address() override
+      {
+        return m_storage;
+      }
+
+    private:
+      std::atomic<int> m_status{Pending};
+      bool m_hasValue = false;
+      Continuation m_continuation = nullptr;
+      void *m_context = nullptr;
+      std::exception_ptr m_error;
+      alignas(T) unsigned char m_storage[sizeof(T)];
+
+      T *value()
+      {
+        return std::launder(reinterpret_cast<T *>(m_storage));
+      }
+    };
+
+    inline void releaseState(BlockControl *state)
+    {
+      if (state && state->releaseRef())
+      {
+        state->releaseObject();
+      }
+    }
+
+    /**
+     * @brief State of the Future returned by then(), also holds the function and the source state
+     *
+     * It is its own Promise: one reference is held by the installed continuation and dropped once
+     * the function has run.
+     */
+    template <typename T, typename F, typename R>
+    class ThenState : public FutureState<R>
+    {
+    public:
+      ThenState(FutureState<T> *source, F function) : m_source(source), m_function(std::move(function))
+      {
+        this->addRef(); // The reference of the continuation, the first one is for the Future
+      }
+
+      ~ThenState() override
+      {
+        releaseState(m_source);
+      }
+
+      /**
+       * @brief Install run() as the continuation of the source state
+       *
+       * @return bool false if the source result is already set, run() must then be called directly
+       */
+      bool install()
+      {
+        return m_source->onReady(&ThenState::run, this);
+      }
+
+      /**
+       * @brief Run the function on the result of the source state, once it is set
+       *
+       * Only the function and the construction of its result are guarded, an exception of either
+       * becomes the result. The continuations of this state run outside of the guard.
+       */
+      static void run(void *context) noexcept
+      {
+        ThenState *self = static_cast<ThenState *>(context);
+        if (std::exception_ptr error = self->m_source->error())
+        {
+          self->storeException(error);
+        }
+        else
+        {
+          try
+          {
+            self->store(self->m_function(self->m_source->take()));
+          }
+          catch (...)
+          {
+            self->storeException(std::current_exception());
+          }
+        }
+        self->publish();
+        releaseState(std::exchange(self->m_source, nullptr));
+        releaseState(self);
+      }
+
+    private:
+      FutureState<T> *m_source;
+      F m_function;
+    };
+
+  } // namespace detail
+
+  /**
+   * @brief Producer side of a single-allocation future
+   *
+   * The Promise and its Future share one control block. Destroying a Promise without setting a
+   * result sets a broken_promise error.
+   */
+  template <typename T>
+  class Promise
+  {
+    static_assert(!std::is_void_v<T> && !std::is_reference_v<T>, "Promise results must be objects");
+
+  public:
+    /**
+     * @brief Constructor allocates the shared state
+     */
+    Promise() : m_state(new detail::FutureState<T>())
+    {
+    }
+
+    /**
+     * @brief Destructor breaks the promise if no result was set
+     */
+    ~Promise()
+    {
+      if (m_state && !m_done)
+      {
+        m_state->storeException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        m_state->publish();
+      }
+      detail::releaseState(m_state);
+    }
+
+    // Move-only
+    Promise(Promise &&other) noexcept : m_state(std::exchange(other.m_state, nullptr)), m_done(other.m_done), m_retrieved(other.m_retrieved)
+    {
+    }
+
+    Promise &operator=(Promise &&other) noexcept
+    {
+      if (this != &other)
+      {
+        Promise moved(std::move(other));
+        std::swap(m_state, moved.m_state);
+        std::swap(m_done, moved.m_done);
+        std::swap(m_retrieved, moved.m_retrieved);
+      }
+      return *this;
+    }
+
+    Promise(const Promise &) = delete;
+    Promise &operator=(const Promise &) = delete;
+
+    /**
+     * @brief Get the Future of this promise, only once
+     *
+     * @return Future<T>
+     */
+    Future<T> getFuture()
+    {
+      if (m_retrieved)
+      {
+        throw std::future_error(std::future_errc::future_already_retrieved);
+      }
+      m_retrieved = true;
+      m_state->addRef();
+      return Future<T>(m_state);
+    }
+
+    /**
+     * @brief Set the result, continuations run on the calling thread
+     *
+     * If the constructor of the result throws, the promise is still not satisfied. Continuations
+     * must not throw, an exception escaping one terminates.
+     */
+    template <typename... Args>
+    void setValue(Args &&...args)
+    {
+      checkNotDone();
+      m_state->store(std::forward<Args>(args)...);
+      m_done = true;
+      m_state->publish();
+    }
+
+    /**
+     * @brief Set an exception, continuations run on the calling thread
+     */
+    void setException(std::exception_ptr error)
+    {
+      checkNotDone();
+      m_state->storeException(std::move(error));
+      m_done = true;
+      m_state->publish();
+    }
+
+  private:
+    detail::FutureState<T> *m_state;
+    bool m_done = false;
+    bool m_retrieved = false;
+
+    void checkNotDone() const
+    {
+      if (m_done)
+      {
+        throw std::future_error(std::future_errc::promise_already_satisfied);
+      }
+    }
+  };
+
+  /**
+   * @brief Consumer side of a single-allocation future
+   *
+   * The result is consumed once, by get(), then() or co_await. Waiting on a result that is already
+   * set takes no lock and no system call.
+   */
+  template <typename T>
+  class Future
+  {
+  public:
+    /**
+     * @brief Default constructor, no shared state
+     */
+    Future() = default;
+
+    ~Future()
+    {
+      detail::releaseState(m_state);
+    }
+
+    // Move-only
+    Future(Future &&other) noexcept : m_state(std::exchange(other.m_state, nullptr))
+    {
+    }
+
+    Future &operator=(Future &&other) noexcept
+    {
+      if (this != &other)
+      {
+        detail::releaseState(std::exchange(m_state, std::exchange(other.m_state, nullptr)));
+      }
+      return *this;
+    }
+
+    Future(const Future &) = delete;
+    Future &operator=(const Future &) = delete;
+
+    /**
+     * @brief Check if the future has a shared state
+     */
+    bool valid() const
+    {
+      return m_state != nullptr;
+    }
+
+    /**
+     * @brief Check if the result is set, throws future_error without a shared state
+     */
+    bool ready() const
+    {
+      checkValid();
+      return m_state->ready();
+    }
+
+    /**
+     * @brief Sleep until the result is set, throws future_error without a shared state
+     */
+    void wait() const
+    {
+      checkValid();
+      m_state->wait();
+    }
+
+    /**
+     * @brief Wait for the result and take it, the future is no longer valid afterwards
+     *
+     * @return T the result, or throws the exception set by the producer
+     */
+    T get()
+    {
+      checkValid();
+      Future consumed(std::move(*this));
+      consumed.m_state->wait();
+      return consumed.m_state->take();
+    }
+
+    /**
+     * @brief Chain a function on the result, the future is no longer valid afterwards
+     *
+     * The function runs on the thread that sets the result, or right away if it is already set.
+     * An exception of this future skips the function and is forwarded to the returned one.
+     *
+     * @return Future<R> the future of the value returned by the function
+     */
+    template <typename F, typename R = std::invoke_result_t<F, T>>
+    auto then(F function)
+    {
+      static_assert(!std::is_void_v<R>, "then() functions must return a value, there is no Future<void>");
+      // a void function only gets the assertion above, nothing below is instantiated for it
+      if constexpr (!std::is_void_v<R>)
+      {
+        checkValid();
+        using State = detail::ThenState<T, F, R>;
+        State *next = new State(std::exchange(m_state, nullptr), std::move(function));
+        Future<R> future(next);
+        if (!next->install())
+        {
+          State::run(next);
+        }
+        return future;
+      }
+    }
+
+#if defined(__cpp_impl_coroutine)
+    /**
+     * @brief Awaiting a future suspends the coroutine until the result is set, then takes it
+     */
+    auto operator co_await() &&
+    {
+      struct Awaiter
+      {
+        Future future;
+
+        bool await_ready() const
+        {
+          return future.ready();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+          return future.m_state->onReady([](void *address) noexcept
+                                         { std::coroutine_handle<>::from_address(address).resume(); },
+                                         handle.address());
+        }
+
+        T await_resume()
+        {
+          return future.get();
+        }
+      };
+      checkValid();
+      return Awaiter{std::move(*this)};
+    }
+#endif // __cpp_impl_coroutine
+
+  private:
+    template <typename U>
+    friend class Promise;
+    template <typename U>
+    friend class Future;
+
+    detail::FutureState<T> *m_state = nullptr;
+
+    explicit Future(detail::FutureState<T> *state) : m_state(state)
+    {
+    }
+
+    void checkValid() const
+    {
+      if (!m_state)
+      {
+        noState();
+      }
+    }
+
+    // kept apart so that checkValid() is inlined and the compiler sees m_state is set after it
+    [[noreturn]] static void noState()
+    {
+      throw std::future_error(std::future_errc::no_state);
+    }
+  };
+
+  /**
+   * @brief Get a future already holding a value
+   *
+   * @return Future<T>
+   */
+  template <typename T, typename... Args>
+  Future<T> makeReadyFuture(Args &&...args)
+  {
+    Promise<T> promise;
+    promise.setValue(std::forward<Args>(args)...);
+    return promise.getFuture();
+  }
+
+SP_END_NAMESPACE
+
+#endif // SP_FUTURE_H
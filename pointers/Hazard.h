@@ -0,0 +1,288 @@
+#ifndef SP_HAZARD_H
+#define SP_HAZARD_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "Abi.h"
+
+SP_BEGIN_NAMESPACE
+
+  template <typename T>
+  class Weak;
+
+  template <typename T>
+  class AtomicWeak;
+
+  namespace detail
+  {
+
+    // hazard slots of one thread, padded so that protecting an object never writes to a shared cache line
+    struct alignas(64) HazardRecord
+    {
+      static constexpr std::size_t Slots = 8;
+
+      std::atomic<const void *> hazards[Slots] = {}; // Blocks currently protected by the owner thread
+      std::atomic<bool> inUse{true};                 // Record owned by a live thread
+      unsigned used = 0;                             // Bitmask of the slots in use, only touched by the owner thread
+      HazardRecord *next = nullptr;
+    };
+
+    /**
+     * @brief Process-wide hazard domain, holds every hazard slot and the blocks waiting for them
+     */
+    class HazardDomain
+    {
+    public:
+      static HazardDomain &instance()
+      {
+        static HazardDomain domain;
+        return domain;
+      }
+
+      /**
+       * @brief Get a record, reusing the one of an exited thread if possible
+       */
+      HazardRecord *acquireRecord()
+      {
+        for (HazardRecord *record = m_records.load(std::memory_order_acquire); record; record = record->next)
+        {
+          bool expected = false;
+          if (!record->inUse.load(std::memory_order_relaxed) && record->inUse.compare_exchange_strong(expected, true))
+          {
+            return record;
+          }
+        }
+        HazardRecord *record = new HazardRecord();
+        record->next = m_records.load(std::memory_order_relaxed);
+        while (!m_records.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+        return record;
+      }
+
+      /**
+       * @brief Check if a hazard slot points at the given block
+       */
+      bool isProtected(const void *block) const
+      {
+        for (HazardRecord *record = m_records.load(std::memory_order_acquire); record; record = record->next)
+        {
+          for (const auto &hazard : record->hazards)
+          {
+            if (hazard.load() == block)
+            {
+              return true;
+            }
+          }
+        }
+        return false;
+      }
+
+      /**
+       * @brief Check if a hazard slot points at a block whose last reference was just dropped
+       *
+       * The fence pairs with the hazard store and the sequentially consistent check of the
+       * protecting thread: either it sees the released count or its hazard is seen here.
+       */
+      bool isProtectedAfterRelease(const void *block) const
+      {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return isProtected(block);
+      }
+
+      /**
+       * @brief Defer the reclamation of a block until no hazard slot points at it
+       */
+      void retire(void *block, void (*reclaim)(void *))
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_retiredMutex);
+          m_retired.push_back({block, reclaim});
+          m_retiredCount.store(m_retired.size(), std::memory_order_release);
+        }
+        scan();
+      }
+
+      /**
+       * @brief Reclaim the retired blocks that are no longer protected
+       */
+      void scan()
+      {
+        if (m_retiredCount.load(std::memory_order_acquire) == 0)
+        {
+          return;
+        }
+        std::vector<Retired> ready;
+        {
+          std::lock_guard<std::mutex> lock(m_retiredMutex);
+          std::size_t kept = 0;
+          for (std::size_t i = 0; i < m_retired.size(); ++i)
+          {
+            if (isProtected(m_retired[i].block))
+            {
+              m_retired[kept++] = m_retired[i];
+            }
+            else
+            {
+              ready.push_back(m_retired[i]);
+            }
+          }
+          m_retired.resize(kept);
+          m_retiredCount.store(kept, std::memory_order_release);
+        }
+        // reclaim outside of the lock, it may release other blocks
+        for (const Retired &retired : ready)
+        {
+          retired.reclaim(retired.block);
+        }
+      }
+
+      /**
+       * @brief Get the number of blocks waiting for their hazards to be released
+       */
+      std::size_t pending() const
+      {
+        return m_retiredCount.load(std::memory_order_acquire);
+      }
+
+    private:
+      struct Retired
+      {
+        void *block;
+        void (*reclaim)(void *);
+      };
+
+      HazardDomain() = default;
+
+      std::atomic<HazardRecord *> m_records{nullptr};
+      std::mutex m_retiredMutex;
+      std::vector<Retired> m_retired;
+      std::atomic<std::size_t> m_retiredCount{0};
+    };
+
+    // gives the record back to the domain when the thread exits
+    struct HazardThread
+    {
+      HazardRecord *record = HazardDomain::instance().acquireRecord();
+
+      ~HazardThread()
+      {
+        record->inUse.store(false, std::memory_order_release);
+      }
+    };
+
+    inline HazardRecord &hazardRecord()
+    {
+      static thread_local HazardThread thread;
+      return *thread.record;
+    }
+
+  } // namespace detail
+
+  /**
+   * @brief Hazard pointer, protects an object managed by Shared pointers without touching its counts
+   *
+   * While the guard protects an object, the deletion of that object is deferred even if its last
+   * Shared pointer is released. Guards are meant for short read-side sections and are bound to
+   * the thread that created them.
+   */
+  class HazardGuard
+  {
+  public:
+    /**
+     * @brief Constructor takes a free hazard slot of the current thread
+     */
+    HazardGuard() : m_record(detail::hazardRecord())
+    {
+      for (m_slot = 0; m_slot < detail::HazardRecord::Slots; ++m_slot)
+      {
+        if (!(m_record.used & (1u << m_slot)))
+        {
+          m_record.used |= 1u << m_slot;
+          return;
+        }
+      }
+      throw std::runtime_error("Too many hazard guards on this thread");
+    }
+
+    /**
+     * @brief Destructor releases the protection and the slot
+     */
+    ~HazardGuard()
+    {
+      reset();
+      m_record.used &= ~(1u << m_slot);
+    }
+
+    // Non-copyable
+    HazardGuard(const HazardGuard &) = delete;
+    HazardGuard &operator=(const HazardGuard &) = delete;
+
+    /**
+     * @brief Protect the object observed by a Weak pointer
+     *
+     * @return T* the object, or nullptr if it has already been released
+     */
+    template <typename T>
+    T *protect(const Weak<T> &weak)
+    {
+      auto *block = weak.m_block;
+      if (!block)
+      {
+        reset();
+        return nullptr;
+      }
+      block->markHazardous(); // Under the reference of the Weak pointer, so a later last release sees it
+      m_record.hazards[m_slot].store(block);
+      // the store above is ordered before this load, a releasing thread sees either the hazard or our failure
+      if ((block->refCount.load() & ~block->HazardFlag) == 0)
+      {
+        reset();
+        return nullptr;
+      }
+      return weak.m_ptr;
+    }
+
+    /**
+     * @brief Release the protection, a deferred deletion may happen here
+     */
+    void reset()
+    {
+      if (m_record.hazards[m_slot].load(std::memory_order_relaxed))
+      {
+        m_record.hazards[m_slot].store(nullptr, std::memory_order_release);
+        detail::HazardDomain::instance().scan();
+      }
+    }
+
+  private:
+    template <typename T>
+    friend class AtomicWeak; // Allow AtomicWeak to protect the block it reads from its slot
+
+    detail::HazardRecord &m_record;
+    std::size_t m_slot = 0;
+
+    /**
+     * @brief Protect a block, the caller checks afterwards that it is still reachable
+     */
+    void protectBlock(const void *block)
+    {
+      m_record.hazards[m_slot].store(block);
+    }
+  };
+
+  /**
+   * @brief Reclaim every deferred object that is no longer protected
+   */
+  inline void reclaimHazards()
+  {
+    detail::HazardDomain::instance().scan();
+  }
+
+SP_END_NAMESPACE
+
+#endif // SP_HAZARD_H
@@ -0,0 +1,563 @@
+#ifndef SP_IPCSHARED_H
+#define SP_IPCSHARED_H
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Abi.h"
+#include "Offset.h"
+
+SP_BEGIN_NAMESPACE
+
+  namespace detail
+  {
+
+    // references one process holds on one block, so that they can be dropped if it dies
+    struct IpcLedgerEntry
+    {
+      std::uint64_t block; // Offset of the block from the segment header, 0 for a free entry
+      std::uint64_t count;
+    };
+
+    // reference ledger of one process
+    struct IpcLedger
+    {
+      static constexpr std::size_t Entries = 128;
+      static constexpr std::int32_t Recovering = -1;
+
+      std::atomic<std::int32_t> pid; // Owner process, 0 when free, Recovering while another process drops its references
+      std::atomic<bool> lock;        // Guards the entries between the threads of the owner process
+      IpcLedgerEntry entries[Entries];
+    };
+
+    // entry point of a cross-process segment, placed in the first allocation
+    struct IpcDirectory
+    {
+      static constexpr std::uint64_t Magic = 0x73702d6970633031ULL; // "sp-ipc01"
+      static constexpr std::size_t Processes = 32;
+
+      std::uint64_t magic;
+      std::atomic<std::uint64_t> published; // Offset of the published block, owned by the segment rather than by a process, changed under the segment lock
+      IpcLedger ledgers[Processes];
+    };
+
+    // count of a block, next to its object
+    struct IpcBlockHeader
+    {
+      std::atomic<std::size_t> refCount;
+
+      // take a reference unless the count already dropped to zero
+      bool tryAddRef()
+      {
+        std::size_t count = refCount.load(std::memory_order_relaxed);
+        while (count != 0)
+        {
+          if (refCount.compare_exchange_weak(count, count + 1, std::memory_order_relaxed))
+          {
+            return true;
+          }
+        }
+        return false;
+      }
+    };
+
+    template <typename T>
+    struct IpcBlock : IpcBlockHeader
+    {
+      T object;
+
+      template <typename... Args>
+      IpcBlock(Args &&...args) : IpcBlockHeader{{1}}, object(std::forward<Args>(args)...)
+      {
+      }
+    };
+
+    inline SegmentHeader &segmentOf(const void *payload)
+    {
+      return *SegmentChunk::of(const_cast<void *>(payload))->segment();
+    }
+
+    inline IpcDirectory &directoryOf(SegmentHeader &segment)
+    {
+      return *static_cast<IpcDirectory *>(segment.root.get());
+    }
+
+    inline std::uint64_t blockOffset(SegmentHeader &segment, const IpcBlockHeader *block)
+    {
+      return static_cast<std::uint64_t>(reinterpret_cast<const char *>(block) - reinterpret_cast<const char *>(&segment));
+    }
+
+    inline IpcBlockHeader *blockAt(SegmentHeader &segment, std::uint64_t offset)
+    {
+      return reinterpret_cast<IpcBlockHeader *>(reinterpret_cast<char *>(&segment) + offset);
+    }
+
+    inline bool processDead(std::int32_t pid)
+    {
+      return pid > 0 && ::kill(pid, 0) != 0 && errno == ESRCH;
+    }
+
+    /**
+     * @brief Drop the last reference on a block, its memory goes back to the segment
+     */
+    inline void ipcFree(IpcBlockHeader *block)
+    {
+      segmentDeallocate(block);
+    }
+
+    /**
+     * @brief Drop the references held by dead processes
+     *
+     * @return std::size_t the number of ledgers recovered
+     */
+    inline std::size_t ipcRecover(SegmentHeader &segment)
+    {
+      IpcDirectory &directory = directoryOf(segment);
+      std::size_t recovered = 0;
+      for (IpcLedger &ledger : directory.ledgers)
+      {
+        std::int32_t pid = ledger.pid.load(std::memory_order_acquire);
+        if (!processDead(pid) || !ledger.pid.compare_exchange_strong(pid, IpcLedger::Recovering))
+        {
+          continue;
+        }
+        // the owner is dead, its thread lock is ignored
+        for (IpcLedgerEntry &entry : ledger.entries)
+        {
+          if (entry.block && entry.count)
+          {
+            IpcBlockHeader *block = blockAt(segment, entry.block);
+            if (block->refCount.fetch_sub(entry.count, std::memory_order_acq_rel) == entry.count)
+            {
+              ipcFree(block);
+            }
+          }
+          entry = IpcLedgerEntry{0, 0};
+        }
+        ledger.lock.store(false);
+        ledger.pid.store(0, std::memory_order_release);
+        ++recovered;
+      }
+      return recovered;
+    }
+
+    /**
+     * @brief Get the ledger of the current process, claimed on first use
+     */
+    inline IpcLedger &ipcLedger(SegmentHeader &segment)
+    {
+      struct Cache
+      {
+        SegmentHeader *segment = nullptr;
+        std::int32_t pid = 0;
+        IpcLedger *ledger = nullptr;
+      };
+      static thread_local Cache cache;
+      const std::int32_t self = static_cast<std::int32_t>(::getpid());
+      // a new segment may be mapped where an old one was, the ledger must still be claimed by this process
+      if (cache.segment == &segment && cache.pid == self && cache.ledger->pid.load(std::memory_order_relaxed) == self)
+      {
+        return *cache.ledger;
+      }
+      IpcDirectory &directory = directoryOf(segment);
+      for (int attempt = 0; attempt < 2; ++attempt)
+      {
+        for (IpcLedger &ledger : directory.ledgers)
+        {
+          if (ledger.pid.load(std::memory_order_acquire) == self)
+          {
+            cache = Cache{&segment, self, &ledger};
+            return ledger;
+          }
+        }
+        for (IpcLedger &ledger : directory.ledgers)
+        {
+          std::int32_t expected = 0;
+          if (ledger.pid.compare_exchange_strong(expected, self))
+          {
+            cache = Cache{&segment, self, &ledger};
+            return ledger;
+          }
+        }
+        ipcRecover(segment); // Every ledger is taken, free those of dead processes
+      }
+      throw std::runtime_error("Too many processes on the segment");
+    }
+
+    /**
+     * @brief Record a change of the references the current process holds on a block
+     */
+    inline void ipcRecord(SegmentHeader &segment, const IpcBlockHeader *block, std::int64_t delta)
+    {
+      IpcLedger &ledger = ipcLedger(segment);
+      std::uint64_t offset = blockOffset(segment, block);
+      while (ledger.lock.exchange(true, std::memory_order_acquire))
+      {
+        std::this_thread::yield();
+      }
+      IpcLedgerEntry *found = nullptr;
+      IpcLedgerEntry *unused = nullptr;
+      for (IpcLedgerEntry &entry : ledger.entries)
+      {
+        if (entry.block == offset)
+        {
+          found = &entry;
+          break;
+        }
+        if (!unused && (entry.block == 0 || entry.count == 0))
+        {
+          unused = &entry;
+        }
+      }
+      if (!found && unused)
+      {
+        found = unused;
+        found->block = offset;
+        found->count = 0;
+      }
+      if (found)
+      {
+        found->count += delta;
+      }
+      ledger.lock.store(false, std::memory_order_release);
+      if (!found)
+      {
+        throw std::runtime_error("Too many blocks referenced by this process");
+      }
+    }
+
+  } // namespace detail
+
+  /**
+   * @brief Smart shared pointer on an object in a segment shared between processes
+   *
+   * The count is an atomic in the segment, the object goes back to the segment allocator when
+   * the last handle of any process is released. Every process also records its references in its
+   * own ledger in the segment: the references of a process that died without releasing them are
+   * dropped by IpcSegment::recover(). A reference is counted before it is recorded and unrecorded
+   * before it is released, so a crash in between leaks it rather than freeing a live object.
+   *
+   * Handles must not be inherited through fork, a child takes its own from IpcSegment::published().
+   * Objects are freed by any process without running their destructor, hence trivially destructible.
+   */
+  template <typename T>
+  class IpcShared
+  {
+    static_assert(std::is_trivially_destructible<T>::value, "objects shared between processes must be trivially destructible");
+
+  public:
+    IpcShared() = default;
+
+    ~IpcShared()
+    {
+      reset();
+    }
+
+    IpcShared(const IpcShared &other) : m_block(other.m_block)
+    {
+      acquire();
+    }
+
+    IpcShared &operator=(const IpcShared &other)
+    {
+      if (this != &other)
+      {
+        reset();
+        m_block = other.m_block;
+        acquire();
+      }
+      return *this;
+    }
+
+    IpcShared(IpcShared &&other) noexcept : m_block(other.m_block)
+    {
+      other.m_block = nullptr;
+    }
+
+    IpcShared &operator=(IpcShared &&other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        m_block = other.m_block;
+        other.m_block = nullptr;
+      }
+      return *this;
+    }
+
+    T *get() const
+    {
+      return m_block ? &m_block->object : nullptr;
+    }
+
+    T &operator*() const
+    {
+      if (!m_block)
+      {
+        throw std::runtime_error("Null pointer exception");
+      }
+      return m_block->object;
+    }
+
+    T *operator->() const
+    {
+      return get();
+    }
+
+    /**
+     * @brief Get the reference count over every process
+     */
+    std::size_t count() const
+    {
+      return m_block ? m_block->refCount.load(std::memory_order_acquire) : 0;
+    }
+
+    bool exists() const
+    {
+      return m_block;
+    }
+
+    operator bool() const
+    {
+      return exists();
+    }
+
+    /**
+     * @brief Release the pointer
+     */
+    void reset()
+    {
+      if (detail::IpcBlock<T> *block = m_block.get())
+      {
+        detail::ipcRecord(detail::segmentOf(block), block, -1);
+        if (block->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+          detail::ipcFree(block);
+        }
+        m_block = nullptr;
+      }
+    }
+
+  private:
+    friend class IpcSegment;
+
+    OffsetPtr<detail::IpcBlock<T>> m_block;
+
+    /**
+     * @brief Adopt a reference already counted but not recorded yet
+     */
+    explicit IpcShared(detail::IpcBlock<T> *block) : m_block(block)
+    {
+      try
+      {
+        detail::ipcRecord(detail::segmentOf(block), block, 1);
+      }
+      catch (...)
+      {
+        if (block->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+          detail::ipcFree(block);
+        }
+        throw;
+      }
+    }
+
+    void acquire()
+    {
+      if (detail::IpcBlock<T> *block = m_block.get())
+      {
+        block->refCount.fetch_add(1, std::memory_order_relaxed);
+        try
+        {
+          detail::ipcRecord(detail::segmentOf(block), block, 1);
+        }
+        catch (...)
+        {
+          m_block = nullptr;
+          if (block->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          {
+            detail::ipcFree(block);
+          }
+          throw;
+        }
+      }
+    }
+  };
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  /**
+   * @brief Segment of shared memory holding objects shared between processes
+   */
+  class IpcSegment
+  {
+  public:
+    /**
+     * @brief Create a named segment with shm_open, it must not exist yet
+     */
+    static IpcSegment create(const std::string &name, std::size_t size)
+    {
+      int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+      if (fd < 0)
+      {
+        throw std::runtime_error("Cannot create shared memory " + name);
+      }
+      return IpcSegment(Segment::adopt(fd, size), true);
+    }
+
+    /**
+     * @brief Map a named segment created by another process
+     */
+    static IpcSegment open(const std::string &name)
+    {
+      int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+      if (fd < 0)
+      {
+        throw std::runtime_error("Cannot open shared memory " + name);
+      }
+      return IpcSegment(Segment::adopt(fd), false);
+    }
+
+    /**
+     * @brief Remove the name of a segment, mappings stay valid
+     */
+    static void unlink(const std::string &name)
+    {
+      ::shm_unlink(name.c_str());
+    }
+
+    /**
+     * @brief Create an unnamed segment with memfd_create, shared with the children forked afterwards
+     */
+    static IpcSegment anonymous(std::size_t size)
+    {
+      int fd = ::memfd_create("sp-ipc", 0);
+      if (fd < 0)
+      {
+        throw std::runtime_error("Cannot create shared memory");
+      }
+      return IpcSegment(Segment::adopt(fd, size), true);
+    }
+
+    /**
+     * @brief make a shared pointer in the segment
+     */
+    template <typename T, typename... Args>
+    IpcShared<T> makeShared(Args &&...args)
+    {
+      static_assert(alignof(T) <= detail::SegmentChunk::Alignment, "segment objects must not be over-aligned");
+      void *memory = m_segment.allocate(sizeof(detail::IpcBlock<T>));
+      return IpcShared<T>(new (memory) detail::IpcBlock<T>(std::forward<Args>(args)...));
+    }
+
+    /**
+     * @brief Publish an object for the other processes, the segment holds a reference on it
+     *
+     * The slot is swapped under the segment lock, published() cannot take a reference on the old
+     * object once this process released the one of the segment.
+     */
+    template <typename T>
+    void publish(const IpcShared<T> &shared)
+    {
+      detail::IpcBlock<T> *block = shared.m_block.get();
+      if (block)
+      {
+        block->refCount.fetch_add(1, std::memory_order_relaxed);
+      }
+      std::uint64_t previous;
+      {
+        detail::SegmentLock lock(header());
+        previous = directory().published.exchange(block ? detail::blockOffset(header(), block) : 0, std::memory_order_acq_rel);
+      }
+      // released out of the lock, freeing the block takes it again
+      if (previous)
+      {
+        detail::IpcBlockHeader *old = detail::blockAt(header(), previous);
+        if (old->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+          detail::ipcFree(old);
+        }
+      }
+    }
+
+    /**
+     * @brief Get the published object
+     */
+    template <typename T>
+    IpcShared<T> published()
+    {
+      detail::IpcBlock<T> *block = nullptr;
+      {
+        detail::SegmentLock lock(header());
+        if (std::uint64_t offset = directory().published.load(std::memory_order_acquire))
+        {
+          block = static_cast<detail::IpcBlock<T> *>(detail::blockAt(header(), offset));
+          if (!block->tryAddRef())
+          {
+            block = nullptr;
+          }
+        }
+      }
+      return block ? IpcShared<T>(block) : IpcShared<T>();
+    }
+
+    /**
+     * @brief Drop the references of the processes that died while holding them
+     *
+     * @return std::size_t the number of dead processes cleaned up
+     */
+    std::size_t recover()
+    {
+      return detail::ipcRecover(header());
+    }
+
+    Segment &segment()
+    {
+      return m_segment;
+    }
+
+  private:
+    Segment m_segment;
+
+    IpcSegment(Segment segment, bool initialize) : m_segment(std::move(segment))
+    {
+      if (initialize)
+      {
+        void *memory = m_segment.allocate(sizeof(detail::IpcDirectory));
+        detail::IpcDirectory *directory = new (memory) detail::IpcDirectory();
+        directory->magic = detail::IpcDirectory::Magic;
+        m_segment.setRoot(directory);
+      }
+      else if (!m_segment.root<detail::IpcDirectory>() || m_segment.root<detail::IpcDirectory>()->magic != detail::IpcDirectory::Magic)
+      {
+        throw std::runtime_error("Not a shared memory segment");
+      }
+    }
+
+    detail::SegmentHeader &header()
+    {
+      return *static_cast<detail::SegmentHeader *>(m_segment.base());
+    }
+
+    detail::IpcDirectory &directory()
+    {
+      return *m_segment.root<detail::IpcDirectory>();
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_IPCSHARED_H
@@ -0,0 +1,133 @@
+#ifndef SP_LAZY_H
+#define SP_LAZY_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "Abi.h"
+#include "Shared.h"
+#include "Weak.h"
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Thread-safe lazy initialization holder
+   *
+   * The factory runs exactly once, on first access, even if several threads access the holder at
+   * the same time. Its result is published as a Shared pointer with release ordering; once it is
+   * published an access is a single acquire load. Each holder has its own once flag, initializing
+   * one never blocks the readers of another. If the factory throws, the next access tries again.
+   */
+  template <typename T>
+  class Lazy
+  {
+  public:
+    using Factory = std::function<Shared<T>()>;
+
+    /**
+     * @brief Constructor takes the factory, by default T is built by makeShared
+     */
+    Lazy(Factory factory = []()
+         { return Shared<T>::makeShared(); })
+        : m_factory(std::move(factory))
+    {
+    }
+
+    // Non-copyable
+    Lazy(const Lazy &) = delete;
+    Lazy &operator=(const Lazy &) = delete;
+
+    /**
+     * @brief Get the raw pointer, initializing on first access
+     *
+     * @return T*
+     */
+    T *get()
+    {
+      T *ptr = m_ptr.load(std::memory_order_acquire);
+      return ptr ? ptr : initialize();
+    }
+
+    /**
+     * @brief Get a reference on the value, initializing on first access
+     *
+     * @return T&
+     */
+    T &operator*()
+    {
+      return *get();
+    }
+
+    /**
+     * @brief Get the raw pointer, initializing on first access
+     *
+     * @return T*
+     */
+    T *operator->()
+    {
+      return get();
+    }
+
+    /**
+     * @brief Get a Shared pointer on the value, initializing on first access
+     *
+     * @return Shared<T>
+     */
+    Shared<T> shared()
+    {
+      get();
+      return m_value;
+    }
+
+    /**
+     * @brief Get a Weak pointer on the value, initializing on first access
+     *
+     * @return Weak<T>
+     */
+    Weak<T> weak()
+    {
+      get();
+      return Weak<T>(m_value);
+    }
+
+    /**
+     * @brief Check if the value has been built, never initializes it
+     *
+     * @return bool
+     */
+    bool initialized() const
+    {
+      return m_ptr.load(std::memory_order_acquire) != nullptr;
+    }
+
+  private:
+    std::atomic<T *> m_ptr{nullptr};
+    std::once_flag m_once;
+    Shared<T> m_value; // Written once before m_ptr is published, read-only afterwards
+    Factory m_factory;
+
+    /**
+     * @brief Slow path, run the factory if no other thread did
+     */
+    T *initialize()
+    {
+      std::call_once(m_once, [this]()
+                     {
+        Shared<T> value = m_factory();
+        if (!value)
+        {
+          throw std::runtime_error("Lazy factory returned a null pointer");
+        }
+        m_value = std::move(value);
+        m_factory = nullptr; // Release what the factory captured
+        m_ptr.store(m_value.get(), std::memory_order_release); });
+      return m_ptr.load(std::memory_order_acquire);
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_LAZY_H
@@ -0,0 +1,673 @@
+#ifndef SP_OFFSET_H
+#define SP_OFFSET_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <cerrno>
+#include <csignal>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Abi.h"
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Pointer stored as an offset from its own address
+   *
+   * Valid at any mapping address as long as it and its target live in the same mapping.
+   */
+  template <typename T>
+  class OffsetPtr
+  {
+  public:
+    OffsetPtr(T *ptr = nullptr)
+    {
+      set(ptr);
+    }
+
+    // the offset is recomputed, a copy at another address points at the same target
+    OffsetPtr(const OffsetPtr &other)
+    {
+      set(other.get());
+    }
+
+    OffsetPtr &operator=(const OffsetPtr &other)
+    {
+      set(other.get());
+      return *this;
+    }
+
+    OffsetPtr &operator=(T *ptr)
+    {
+      set(ptr);
+      return *this;
+    }
+
+    /**
+     * @brief Get the raw pointer
+     */
+    T *get() const
+    {
+      if (m_offset == Null)
+      {
+        return nullptr;
+      }
+      return reinterpret_cast<T *>(reinterpret_cast<std::uintptr_t>(this) + m_offset);
+    }
+
+    std::add_lvalue_reference_t<T> operator*() const
+    {
+      return *get();
+    }
+
+    T *operator->() const
+    {
+      return get();
+    }
+
+    operator bool() const
+    {
+      return m_offset != Null;
+    }
+
+  private:
+    // an offset of 1 would point inside the OffsetPtr itself, it stands for nullptr
+    static constexpr std::ptrdiff_t Null = 1;
+
+    std::ptrdiff_t m_offset = Null;
+
+    void set(T *ptr)
+    {
+      m_offset = ptr ? static_cast<std::ptrdiff_t>(reinterpret_cast<std::uintptr_t>(ptr) - reinterpret_cast<std::uintptr_t>(this)) : Null;
+    }
+  };
+
+  namespace detail
+  {
+
+    struct SegmentChunk;
+
+    static_assert(std::atomic<std::int32_t>::is_always_lock_free, "segment locks must work across mappings");
+
+    // start of every segment, everything the allocator needs is stored in the mapping itself
+    struct SegmentHeader
+    {
+      static constexpr std::uint64_t Magic = 0x73702d7365676d31ULL; // "sp-segm1"
+
+      std::uint64_t magic;
+      std::uint64_t size;          // Size of the mapping
+      std::uint64_t used;          // Bytes handed out by the bump allocator, header included
+      std::atomic<std::int32_t> lock; // Pid of the process holding the allocator, works across mappings and processes
+      OffsetPtr<SegmentChunk> freeList;
+      OffsetPtr<void> root;        // Entry point of the object graph
+    };
+
+    // header of every allocation, 16 bytes so that the payload stays aligned
+    struct SegmentChunk
+    {
+      std::uint64_t offset; // Distance from the segment header, to find the segment from any payload
+      std::uint64_t size;   // Payload size
+
+      static constexpr std::size_t Alignment = 16;
+
+      void *payload()
+      {
+        return this + 1;
+      }
+
+      SegmentHeader *segment()
+      {
+        return reinterpret_cast<SegmentHeader *>(reinterpret_cast<char *>(this) - offset);
+      }
+
+      OffsetPtr<SegmentChunk> &next()
+      {
+        return *static_cast<OffsetPtr<SegmentChunk> *>(payload()); // Only while the chunk is free
+      }
+
+      static SegmentChunk *of(void *payload)
+      {
+        return static_cast<SegmentChunk *>(payload) - 1;
+      }
+    };
+
+    // spin lock on the allocator of a segment, taken over if the process holding it died
+    class SegmentLock
+    {
+    public:
+      SegmentLock(SegmentHeader &header) : m_lock(header.lock)
+      {
+        const std::int32_t self = static_cast<std::int32_t>(::getpid());
+        std::int32_t holder = 0;
+        for (unsigned spins = 1; !m_lock.compare_exchange_weak(holder, self, std::memory_order_acquire, std::memory_order_relaxed); ++spins)
+        {
+          if (holder != 0 && holder != self && spins % 64 == 0 && ::kill(holder, 0) != 0 && errno == ESRCH)
+          {
+            continue; // Dead holder, holder now expects its pid and the next exchange takes the lock over
+          }
+          holder = 0;
+          std::this_thread::yield();
+        }
+      }
+
+      ~SegmentLock()
+      {
+        m_lock.store(0, std::memory_order_release);
+      }
+
+    private:
+      std::atomic<std::int32_t> &m_lock;
+    };
+
+    /**
+     * @brief Allocate from the segment a payload belongs to, first fit in the free list then bump
+     */
+    inline void *segmentAllocate(SegmentHeader &header, std::size_t size)
+    {
+      size = std::max(size, sizeof(OffsetPtr<SegmentChunk>)); // Room for the free list link once deallocated
+      size = (size + SegmentChunk::Alignment - 1) & ~(SegmentChunk::Alignment - 1);
+      SegmentLock lock(header);
+      for (OffsetPtr<SegmentChunk> *link = &header.freeList; *link; link = &(*link)->next())
+      {
+        SegmentChunk *chunk = link->get();
+        if (chunk->size >= size)
+        {
+          *link = chunk->next().get();
+          return chunk->payload();
+        }
+      }
+      if (header.used + sizeof(SegmentChunk) + size > header.size)
+      {
+        throw std::bad_alloc();
+      }
+      SegmentChunk *chunk = reinterpret_cast<SegmentChunk *>(reinterpret_cast<char *>(&header) + header.used);
+      chunk->offset = header.used;
+      chunk->size = size;
+      header.used += sizeof(SegmentChunk) + size;
+      return chunk->payload();
+    }
+
+    /**
+     * @brief Give back a payload to the free list of its segment
+     */
+    inline void segmentDeallocate(void *payload)
+    {
+      SegmentChunk *chunk = SegmentChunk::of(payload);
+      SegmentHeader &header = *chunk->segment();
+      SegmentLock lock(header);
+      new (payload) OffsetPtr<SegmentChunk>(header.freeList.get());
+      header.freeList = chunk;
+    }
+
+  } // namespace detail
+
+  /**
+   * @brief Smart unique pointer on an object in a segment, stored as an offset
+   *
+   * Objects of T must themselves only point into the segment through offset-based pointers.
+   */
+  template <typename T>
+  class SegmentUnique
+  {
+  public:
+    SegmentUnique(T *ptr = nullptr) : m_ptr(ptr) {}
+
+    SegmentUnique(SegmentUnique &&other) noexcept : m_ptr(other.m_ptr.get())
+    {
+      other.m_ptr = nullptr;
+    }
+
+    SegmentUnique &operator=(SegmentUnique &&other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        m_ptr = other.m_ptr.get();
+        other.m_ptr = nullptr;
+      }
+      return *this;
+    }
+
+    ~SegmentUnique()
+    {
+      reset();
+    }
+
+    // Non-copyable
+    SegmentUnique(const SegmentUnique &) = delete;
+    SegmentUnique &operator=(const SegmentUnique &) = delete;
+
+    T *get() const
+    {
+      return m_ptr.get();
+    }
+
+    T &operator*() const
+    {
+      return *m_ptr;
+    }
+
+    T *operator->() const
+    {
+      return m_ptr.get();
+    }
+
+    bool exists() const
+    {
+      return m_ptr;
+    }
+
+    operator bool() const
+    {
+      return exists();
+    }
+
+    /**
+     * @brief Destroy the object and give its memory back to the segment
+     */
+    void reset()
+    {
+      if (T *ptr = m_ptr.get())
+      {
+        ptr->~T();
+        detail::segmentDeallocate(ptr);
+        m_ptr = nullptr;
+      }
+    }
+
+  private:
+    OffsetPtr<T> m_ptr;
+  };
+
+  namespace detail
+  {
+
+    // a control block and its object, in one segment allocation
+    template <typename T>
+    struct SegmentBlock
+    {
+      std::atomic<std::size_t> refCount;
+      T object;
+
+      template <typename... Args>
+      SegmentBlock(Args &&...args) : refCount(1), object(std::forward<Args>(args)...)
+      {
+      }
+    };
+
+  } // namespace detail
+
+  /**
+   * @brief Smart shared pointer on an object in a segment, stored as an offset
+   *
+   * The count lives next to the object in the segment, so handles stored in the segment remain
+   * valid once it is mapped again. There is no Weak counterpart.
+   */
+  template <typename T>
+  class SegmentShared
+  {
+  public:
+    SegmentShared() = default;
+
+    ~SegmentShared()
+    {
+      reset();
+    }
+
+    SegmentShared(const SegmentShared &other) : m_block(other.m_block)
+    {
+      if (m_block)
+      {
+        m_block->refCount.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    SegmentShared &operator=(const SegmentShared &other)
+    {
+      if (this != &other)
+      {
+        reset();
+        m_block = other.m_block;
+        if (m_block)
+        {
+          m_block->refCount.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+      return *this;
+    }
+
+    SegmentShared(SegmentShared &&other) noexcept : m_block(other.m_block)
+    {
+      other.m_block = nullptr;
+    }
+
+    SegmentShared &operator=(SegmentShared &&other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        m_block = other.m_block;
+        other.m_block = nullptr;
+      }
+      return *this;
+    }
+
+    T *get() const
+    {
+      return m_block ? &m_block->object : nullptr;
+    }
+
+    T &operator*() const
+    {
+      if (!m_block)
+      {
+        throw std::runtime_error("Null pointer exception");
+      }
+      return m_block->object;
+    }
+
+    T *operator->() const
+    {
+      return get();
+    }
+
+    std::size_t count() const
+    {
+      return m_block ? m_block->refCount.load(std::memory_order_acquire) : 0;
+    }
+
+    bool exists() const
+    {
+      return m_block;
+    }
+
+    operator bool() const
+    {
+      return exists();
+    }
+
+    /**
+     * @brief Release the pointer, the last one gives the memory back to the segment
+     */
+    void reset()
+    {
+      if (m_block && m_block->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+        detail::SegmentBlock<T> *block = m_block.get();
+        block->~SegmentBlock();
+        detail::segmentDeallocate(block);
+      }
+      m_block = nullptr;
+    }
+
+  private:
+    friend class Segment;
+
+    OffsetPtr<detail::SegmentBlock<T>> m_block;
+
+    SegmentShared(detail::SegmentBlock<T> *block) : m_block(block) {}
+  };
+
+  ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  /**
+   * @brief Memory mapping holding an object graph built from offset-based pointers
+   *
+   * A file-backed segment is persisted by the mapping itself: opening it again is a single mmap,
+   * whatever the size of the graph, and the graph is valid at whatever address it is mapped.
+   */
+  class Segment
+  {
+  public:
+    /**
+     * @brief Create a file-backed segment, an existing file is truncated
+     */
+    static Segment create(const std::string &path, std::size_t size)
+    {
+      int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+      if (fd < 0)
+      {
+        throw std::runtime_error("Cannot create segment " + path);
+      }
+      return adopt(fd, size);
+    }
+
+    /**
+     * @brief Map an existing file-backed segment
+     */
+    static Segment open(const std::string &path)
+    {
+      int fd = ::open(path.c_str(), O_RDWR);
+      if (fd < 0)
+      {
+        throw std::runtime_error("Cannot open segment " + path);
+      }
+      return adopt(fd);
+    }
+
+    /**
+     * @brief Map a segment from an open file descriptor, the segment takes ownership of it
+     *
+     * @param size the size of a new segment, 0 to map an existing one
+     */
+    static Segment adopt(int fd, std::size_t size = 0)
+    {
+      if (size != 0)
+      {
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+          closeFile(fd);
+          throw std::runtime_error("Cannot resize segment");
+        }
+        Segment segment(map(fd, size), size, fd);
+        segment.initialize();
+        return segment;
+      }
+      struct stat status;
+      if (::fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(detail::SegmentHeader))
+      {
+        closeFile(fd);
+        throw std::runtime_error("Not a segment");
+      }
+      size = static_cast<std::size_t>(status.st_size);
+      Segment segment(map(fd, size), size, fd);
+      if (segment.header().magic != detail::SegmentHeader::Magic || segment.header().size != size)
+      {
+        throw std::runtime_error("Not a segment");
+      }
+      return segment;
+    }
+
+    /**
+     * @brief Create a segment in anonymous memory
+     */
+    static Segment anonymous(std::size_t size)
+    {
+      Segment segment(map(-1, size), size, -1);
+      segment.initialize();
+      return segment;
+    }
+
+    ~Segment()
+    {
+      if (m_base)
+      {
+        ::munmap(m_base, m_size);
+      }
+      closeFile(m_fd);
+    }
+
+    Segment(Segment &&other) noexcept : m_base(other.m_base), m_size(other.m_size), m_fd(other.m_fd)
+    {
+      other.m_base = nullptr;
+      other.m_fd = -1;
+    }
+
+    // Non-copyable
+    Segment(const Segment &) = delete;
+    Segment &operator=(const Segment &) = delete;
+    Segment &operator=(Segment &&) = delete;
+
+    /**
+     * @brief Allocate raw memory in the segment, 16-byte aligned
+     */
+    void *allocate(std::size_t size)
+    {
+      return detail::segmentAllocate(header(), size);
+    }
+
+    /**
+     * @brief Give back memory allocated in the segment
+     */
+    void deallocate(void *ptr)
+    {
+      detail::segmentDeallocate(ptr);
+    }
+
+    /**
+     * @brief make a unique pointer in the segment
+     */
+    template <typename T, typename... Args>
+    SegmentUnique<T> makeUnique(Args &&...args)
+    {
+      static_assert(alignof(T) <= detail::SegmentChunk::Alignment, "segment objects must not be over-aligned");
+      void *memory = allocate(sizeof(T));
+      try
+      {
+        return SegmentUnique<T>(new (memory) T(std::forward<Args>(args)...));
+      }
+      catch (...)
+      {
+        deallocate(memory);
+        throw;
+      }
+    }
+
+    /**
+     * @brief make a shared pointer in the segment
+     */
+    template <typename T, typename... Args>
+    SegmentShared<T> makeShared(Args &&...args)
+    {
+      static_assert(alignof(T) <= detail::SegmentChunk::Alignment, "segment objects must not be over-aligned");
+      void *memory = allocate(sizeof(detail::SegmentBlock<T>));
+      try
+      {
+        return SegmentShared<T>(new (memory) detail::SegmentBlock<T>(std::forward<Args>(args)...));
+      }
+      catch (...)
+      {
+        deallocate(memory);
+        throw;
+      }
+    }
+
+    /**
+     * @brief Get the entry point of the graph
+     */
+    template <typename T>
+    T *root() const
+    {
+      return static_cast<T *>(header().root.get());
+    }
+
+    /**
+     * @brief Set the entry point of the graph, it must live in the segment
+     */
+    template <typename T>
+    void setRoot(T *root)
+    {
+      header().root = static_cast<void *>(root);
+    }
+
+    /**
+     * @brief Check if a pointer is inside the segment
+     */
+    bool contains(const void *ptr) const
+    {
+      return ptr >= m_base && ptr < static_cast<const char *>(m_base) + m_size;
+    }
+
+    /**
+     * @brief Get the bytes in use, headers included
+     */
+    std::size_t used() const
+    {
+      return header().used;
+    }
+
+    /**
+     * @brief Flush a file-backed segment to its file
+     */
+    void sync()
+    {
+      ::msync(m_base, m_size, MS_SYNC);
+    }
+
+    void *base() const
+    {
+      return m_base;
+    }
+
+  private:
+    void *m_base;
+    std::size_t m_size;
+    int m_fd;
+
+    Segment(void *base, std::size_t size, int fd) : m_base(base), m_size(size), m_fd(fd) {}
+
+    detail::SegmentHeader &header() const
+    {
+      return *static_cast<detail::SegmentHeader *>(m_base);
+    }
+
+    void initialize()
+    {
+      if (m_size < sizeof(detail::SegmentHeader))
+      {
+        throw std::runtime_error("Segment too small");
+      }
+      detail::SegmentHeader *header = new (m_base) detail::SegmentHeader();
+      header->magic = detail::SegmentHeader::Magic;
+      header->size = m_size;
+      header->used = (sizeof(detail::SegmentHeader) + detail::SegmentChunk::Alignment - 1) & ~(detail::SegmentChunk::Alignment - 1);
+      header->lock.store(0);
+    }
+
+    static void *map(int fd, std::size_t size)
+    {
+      int flags = fd < 0 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED;
+      void *base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+      if (base == MAP_FAILED)
+      {
+        closeFile(fd);
+        throw std::runtime_error("Cannot map segment");
+      }
+      return base;
+    }
+
+    static void closeFile(int fd)
+    {
+      if (fd >= 0)
+      {
+        ::close(fd);
+      }
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_OFFSET_H
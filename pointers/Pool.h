@@ -0,0 +1,277 @@
+#ifndef SP_POOL_H
+#define SP_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "Abi.h"
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Pool settings of a type, specialize it to send makeUnique, makeShared and the matching
+   * deletions of that type to a per-thread free-list pool
+   *
+   * @note usage example: template <> struct sp::PoolTraits<Message> : sp::PoolEnabled {};
+   */
+  template <typename T>
+  struct PoolTraits
+  {
+    static constexpr bool enabled = false;
+  };
+
+  // default settings of a pooled type
+  struct PoolEnabled
+  {
+    static constexpr bool enabled = true;
+    static constexpr std::size_t threadCapacity = 256; // Free objects cached by each thread
+    static constexpr std::size_t depotCapacity = 4096; // Free objects cached in the depot shared by every thread
+  };
+
+  /**
+   * @brief Free-list pool of one type
+   *
+   * Each slot is a plain ::operator new(sizeof(T)) allocation, so an object made with new T can be
+   * given to the pool and a pooled object could be released with delete. Every thread caches free
+   * slots in its own list; an object freed on another thread simply lands in the cache of that
+   * thread. Caches that overflow keep half of their capacity and give the other slots to a shared
+   * depot, which threads with an empty cache refill from, and slots beyond the depot capacity go
+   * back to malloc.
+   */
+  template <typename T>
+  class ObjectPool
+  {
+    using Traits = PoolTraits<T>;
+
+    static_assert(sizeof(T) >= sizeof(void *), "pooled types must be able to hold a free-list link");
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "pooled types must not be over-aligned");
+    static_assert(!std::is_polymorphic<T>::value || std::is_final<T>::value, "pooled polymorphic types must be final");
+
+  public:
+    /**
+     * @brief Get memory for one object
+     *
+     * @return void* never nullptr, throws std::bad_alloc
+     */
+    static void *allocate()
+    {
+      Cache &cache = localCache();
+      if (!cache.head)
+      {
+        depot().take(cache, RefillCount);
+      }
+      if (Node *node = cache.head)
+      {
+        cache.head = node->next;
+        --cache.size;
+        return node;
+      }
+      return ::operator new(sizeof(T));
+    }
+
+    /**
+     * @brief Give back the memory of a destroyed object
+     */
+    static void deallocate(void *ptr)
+    {
+      Cache &cache = localCache();
+      Node *node = static_cast<Node *>(ptr);
+      node->next = cache.head;
+      cache.head = node;
+      if (++cache.size > Traits::threadCapacity)
+      {
+        depot().give(cache, cache.size - Traits::threadCapacity / 2); // At least one slot, even for the smallest capacities
+      }
+    }
+
+    /**
+     * @brief Free the slots cached by the current thread and by the depot
+     */
+    static void trim()
+    {
+      localCache().clear();
+      depot().clear();
+    }
+
+    /**
+     * @brief Get the number of slots cached by the current thread
+     *
+     * @return std::size_t
+     */
+    static std::size_t cached()
+    {
+      return localCache().size;
+    }
+
+  private:
+    static constexpr std::size_t RefillCount = Traits::threadCapacity / 2 > 0 ? Traits::threadCapacity / 2 : 1; // Slots taken from the depot at once
+
+    struct Node
+    {
+      Node *next;
+    };
+
+    // free slots of one thread, handed to the depot when the thread exits
+    struct Cache
+    {
+      Node *head = nullptr;
+      std::size_t size = 0;
+
+      ~Cache()
+      {
+        depot().give(*this, size);
+      }
+
+      void clear()
+      {
+        while (head)
+        {
+          Node *next = head->next;
+          ::operator delete(head);
+          head = next;
+        }
+        size = 0;
+      }
+    };
+
+    // free slots shared by every thread
+    class Depot
+    {
+    public:
+      ~Depot()
+      {
+        clear();
+      }
+
+      /**
+       * @brief Move up to count slots from the depot to a thread cache
+       */
+      void take(Cache &cache, std::size_t count)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (m_head && count-- > 0)
+        {
+          Node *node = m_head;
+          m_head = node->next;
+          --m_size;
+          node->next = cache.head;
+          cache.head = node;
+          ++cache.size;
+        }
+      }
+
+      /**
+       * @brief Move count slots from a thread cache to the depot, the slots over capacity are freed
+       */
+      void give(Cache &cache, std::size_t count)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (cache.head && count-- > 0)
+        {
+          Node *node = cache.head;
+          cache.head = node->next;
+          --cache.size;
+          if (m_size < Traits::depotCapacity)
+          {
+            node->next = m_head;
+            m_head = node;
+            ++m_size;
+          }
+          else
+          {
+            ::operator delete(node);
+          }
+        }
+      }
+
+      /**
+       * @brief Free every slot of the depot
+       */
+      void clear()
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (m_head)
+        {
+          Node *next = m_head->next;
+          ::operator delete(m_head);
+          m_head = next;
+        }
+        m_size = 0;
+      }
+
+    private:
+      std::mutex m_mutex;
+      Node *m_head = nullptr;
+      std::size_t m_size = 0;
+    };
+
+    static Depot &depot()
+    {
+      static Depot depot;
+      return depot;
+    }
+
+    static Cache &localCache()
+    {
+      depot(); // Constructed first so that it outlives the thread caches
+      static thread_local Cache cache;
+      return cache;
+    }
+  };
+
+  namespace detail
+  {
+
+    /**
+     * @brief Make an object, from the pool of its type if it has one
+     */
+    template <typename T, typename... Args>
+    T *newObject(Args &&...args)
+    {
+      if constexpr (PoolTraits<T>::enabled)
+      {
+        void *memory = ObjectPool<T>::allocate();
+        try
+        {
+          return new (memory) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+          ObjectPool<T>::deallocate(memory);
+          throw;
+        }
+      }
+      else
+      {
+        return new T(std::forward<Args>(args)...);
+      }
+    }
+
+    /**
+     * @brief Delete an object, to the pool of its type if it has one
+     */
+    template <typename T>
+    void deleteObject(T *ptr)
+    {
+      if constexpr (PoolTraits<T>::enabled)
+      {
+        if (ptr)
+        {
+          ptr->~T();
+          ObjectPool<T>::deallocate(ptr);
+        }
+      }
+      else
+      {
+        delete ptr;
+      }
+    }
+
+  } // namespace detail
+
+SP_END_NAMESPACE
+
+#endif // SP_POOL_H
@@ -0,0 +1,310 @@
+#ifndef SP_RCU_H
+#define SP_RCU_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Abi.h"
+#include "Shared.h"
+
+SP_BEGIN_NAMESPACE
+
+  namespace detail
+  {
+
+    // a reader slot, one per thread, padded so that readers never write to a shared cache line
+    struct alignas(64) RcuReader
+    {
+      std::atomic<std::uint64_t> epoch{0}; // Epoch seen when entering the read-side section, 0 when quiescent
+      std::atomic<bool> inUse{true};       // Slot owned by a live thread
+      std::size_t nesting = 0;             // Nested read-side sections, only touched by the owner thread
+      RcuReader *next = nullptr;
+    };
+
+    /**
+     * @brief Epoch domain shared by every Rcu instance
+     */
+    class RcuDomain
+    {
+    public:
+      static RcuDomain &instance()
+      {
+        static RcuDomain domain;
+        return domain;
+      }
+
+      /**
+       * @brief Get a reader slot, reusing the one of an exited thread if possible
+       */
+      RcuReader *acquireReader()
+      {
+        for (RcuReader *reader = m_readers.load(std::memory_order_acquire); reader; reader = reader->next)
+        {
+          bool expected = false;
+          if (!reader->inUse.load(std::memory_order_relaxed) && reader->inUse.compare_exchange_strong(expected, true))
+          {
+            return reader;
+          }
+        }
+        RcuReader *reader = new RcuReader();
+        reader->next = m_readers.load(std::memory_order_relaxed);
+        while (!m_readers.compare_exchange_weak(reader->next, reader, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+        return reader;
+      }
+
+      /**
+       * @brief Get the current global epoch
+       */
+      std::uint64_t epoch() const
+      {
+        return m_epoch.load();
+      }
+
+      /**
+       * @brief Start a new epoch
+       *
+       * @return std::uint64_t the epoch that just ended
+       */
+      std::uint64_t advance()
+      {
+        return m_epoch.fetch_add(1);
+      }
+
+      /**
+       * @brief Check if every reader that may still see a version retired at the given epoch has left
+       */
+      bool quiescent(std::uint64_t retiredEpoch) const
+      {
+        for (RcuReader *reader = m_readers.load(std::memory_order_acquire); reader; reader = reader->next)
+        {
+          std::uint64_t epoch = reader->epoch.load();
+          if (epoch != 0 && epoch <= retiredEpoch)
+          {
+            return false;
+          }
+        }
+        return true;
+      }
+
+    private:
+      RcuDomain() = default;
+
+      std::atomic<std::uint64_t> m_epoch{1};
+      std::atomic<RcuReader *> m_readers{nullptr};
+    };
+
+    // gives the reader slot back to the domain when the thread exits
+    struct RcuThread
+    {
+      RcuReader *reader = RcuDomain::instance().acquireReader();
+
+      ~RcuThread()
+      {
+        reader->inUse.store(false, std::memory_order_release);
+      }
+    };
+
+    inline RcuReader &rcuReader()
+    {
+      static thread_local RcuThread thread;
+      return *thread.reader;
+    }
+
+  } // namespace detail
+
+  /**
+   * @brief Read-copy-update container
+   *
+   * Readers enter a read-side section and access the current version without writing to any shared
+   * cache line. Writers publish new versions, old ones are released once every reader that may still
+   * see them has left its read-side section.
+   */
+  template <typename T>
+  class Rcu
+  {
+  public:
+    /**
+     * @brief Read-side section, the version it gives access to stays valid until it is destroyed
+     */
+    class ReadGuard
+    {
+    public:
+      ReadGuard(const Rcu &rcu) : m_reader(detail::rcuReader())
+      {
+        if (m_reader.nesting++ == 0)
+        {
+          m_reader.epoch.store(detail::RcuDomain::instance().epoch());
+        }
+        m_ptr = rcu.m_ptr.load();
+      }
+
+      ~ReadGuard()
+      {
+        if (--m_reader.nesting == 0)
+        {
+          m_reader.epoch.store(0, std::memory_order_release);
+        }
+      }
+
+      ReadGuard(const ReadGuard &) = delete;
+      ReadGuard &operator=(const ReadGuard &) = delete;
+
+      /**
+       * @brief Get the raw pointer
+       */
+      const T *get() const
+      {
+        return m_ptr;
+      }
+
+      /**
+       * @brief Get a reference on the version being read
+       */
+      const T &operator*() const
+      {
+        return *m_ptr;
+      }
+
+      /**
+       * @brief Get the raw pointer
+       */
+      const T *operator->() const
+      {
+        return m_ptr;
+      }
+
+      /**
+       * @brief Check if a version exists
+       */
+      operator bool() const
+      {
+        return m_ptr != nullptr;
+      }
+
+    private:
+      detail::RcuReader &m_reader;
+      const T *m_ptr;
+    };
+
+    /**
+     * @brief Constructor takes the first version
+     */
+    Rcu(Shared<T> initial = Shared<T>())
+        : m_current(std::move(initial))
+    {
+      m_ptr.store(m_current.get());
+    }
+
+    /**
+     * @brief Destructor, no reader may still be inside a read-side section
+     */
+    ~Rcu() = default;
+
+    // Non-copyable
+    Rcu(const Rcu &) = delete;
+    Rcu &operator=(const Rcu &) = delete;
+
+    /**
+     * @brief Enter a read-side section
+     *
+     * @return ReadGuard
+     */
+    ReadGuard read() const
+    {
+      return ReadGuard(*this);
+    }
+
+    /**
+     * @brief Publish a new version, the previous one is released after a grace period
+     */
+    void update(Shared<T> version)
+    {
+      std::lock_guard<std::mutex> lock(m_writer);
+      m_ptr.store(version.get());
+      m_retired.push_back({std::move(m_current), detail::RcuDomain::instance().advance()});
+      m_current = std::move(version);
+      reclaim();
+    }
+
+    /**
+     * @brief Get an owning pointer on the current version
+     *
+     * @return Shared<T>
+     */
+    Shared<T> snapshot() const
+    {
+      std::lock_guard<std::mutex> lock(m_writer);
+      return m_current;
+    }
+
+    /**
+     * @brief Wait until every retired version has been released
+     *
+     * @note must not be called from inside a read-side section
+     */
+    void synchronize()
+    {
+      for (;;)
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_writer);
+          reclaim();
+          if (m_retired.empty())
+          {
+            return;
+          }
+        }
+        std::this_thread::yield();
+      }
+    }
+
+    /**
+     * @brief Get the number of versions waiting for their grace period
+     *
+     * @return std::size_t
+     */
+    std::size_t pending() const
+    {
+      std::lock_guard<std::mutex> lock(m_writer);
+      return m_retired.size();
+    }
+
+  private:
+    struct Retired
+    {
+      Shared<T> version;
+      std::uint64_t epoch;
+    };
+
+    std::atomic<const T *> m_ptr{nullptr};
+    mutable std::mutex m_writer;
+    Shared<T> m_current;
+    std::vector<Retired> m_retired;
+
+    /**
+     * @brief Release the retired versions whose grace period is over
+     */
+    void reclaim()
+    {
+      const detail::RcuDomain &domain = detail::RcuDomain::instance();
+      std::size_t kept = 0;
+      for (std::size_t i = 0; i < m_retired.size(); ++i)
+      {
+        if (!domain.quiescent(m_retired[i].epoch))
+        {
+          m_retired[kept++] = std::move(m_retired[i]);
+        }
+      }
+      m_retired.resize(kept);
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_RCU_H
@@ -0,0 +1,69 @@
+#ifndef SP_RELOCATABLE_H
+#define SP_RELOCATABLE_H
+
+#include <type_traits>
+
+#include "Abi.h"
+
+SP_BEGIN_NAMESPACE
+
+  template <typename T>
+  class Unique;
+  template <typename T>
+  class Shared;
+  template <typename T>
+  class Weak;
+  template <typename T>
+  class Cow;
+  template <typename T>
+  class StripedShared;
+  template <typename T>
+  class ArenaUnique;
+
+  /**
+   * @brief Check if moving an object and destroying the source amounts to copying its bytes
+   *
+   * Specialize it for types that hold no pointer into themselves.
+   */
+  template <typename T>
+  struct is_trivially_relocatable : std::is_trivially_copyable<T>
+  {
+  };
+
+  // the smart pointers only hold pointers to memory they do not live in
+  template <typename T>
+  struct is_trivially_relocatable<Unique<T>> : std::true_type
+  {
+  };
+
+  template <typename T>
+  struct is_trivially_relocatable<Shared<T>> : std::true_type
+  {
+  };
+
+  template <typename T>
+  struct is_trivially_relocatable<Weak<T>> : std::true_type
+  {
+  };
+
+  template <typename T>
+  struct is_trivially_relocatable<Cow<T>> : std::true_type
+  {
+  };
+
+  template <typename T>
+  struct is_trivially_relocatable<StripedShared<T>> : std::true_type
+  {
+  };
+
+  template <typename T>
+  struct is_trivially_relocatable<ArenaUnique<T>> : std::true_type
+  {
+  };
+
+  template <typename T>
+  inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
+
+SP_END_NAMESPACE
+
+#endif // SP_RELOCATABLE_H
@@ -0,0 +1,321 @@
+#ifndef SP_RETENTION_H
+#define SP_RETENTION_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <execinfo.h>
+
+#include "Abi.h"
+#include "Demangle.h"
+
+/**
+ * Registry of the live Shared control blocks, compiled in when SP_TRACK_RETENTION is defined before
+ * the first include of Shared.h. Tracking is off until RetentionTracker::start() is called; while
+ * it is off the hooks cost one relaxed load and never allocate. Once on, each block creation and
+ * deletion takes the lock of one of several shards, picked by block address. Compiled in,
+ * the Shared constructor and makeShared are not inlined so that their return address is the site.
+ */
+
+// hooks of the control block lifetime: created by a Shared constructor, object disposed, block deleted
+#define SP_TRACK_CREATED(T, block, objectBytes, site) ::sp::detail::trackCreated(block, typeid(T), objectBytes, site)
+#define SP_TRACK_DISPOSED(block) ::sp::detail::trackDisposed(block)
+#define SP_TRACK_DELETED(block) ::sp::detail::trackDeleted(block)
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief A live control block seen by the tracker
+   */
+  struct RetainedBlock
+  {
+    const void *block;                       // Control block address
+    std::string type;                        // Demangled type of the managed object
+    std::size_t bytes;                       // Bytes still allocated for the block and, while alive, its object
+    std::chrono::steady_clock::duration age; // Time since the block was created
+    bool weakOnly;                           // The object is destroyed, only Weak pointers keep the block
+    void *site;                              // Return address in the code that created the block
+    std::vector<void *> stack;               // Sampled creation stack, empty if not sampled
+  };
+
+  namespace detail
+  {
+
+    // the live blocks, sharded by block address so that threads creating different blocks rarely share a lock
+    class RetentionRegistry
+    {
+    public:
+      static constexpr std::size_t Shards = 16;
+      static constexpr int StackDepth = 32; // Frames kept in a sampled stack
+
+      static RetentionRegistry &instance()
+      {
+        static RetentionRegistry registry;
+        return registry;
+      }
+
+      std::atomic<bool> enabled{false};
+      std::atomic<std::uint32_t> stackPeriod{0}; // One creation stack sampled in period, zero for none
+
+      void created(const void *block, const std::type_info &type, std::size_t objectBytes, std::size_t blockBytes, void *site)
+      {
+        Entry entry{&type, objectBytes, blockBytes, std::chrono::steady_clock::now(), false, site, {}};
+        static thread_local std::uint32_t countdown = 1;
+        std::uint32_t period = stackPeriod.load(std::memory_order_relaxed);
+        if (period != 0 && --countdown == 0)
+        {
+          countdown = period;
+          void *frames[StackDepth];
+          int depth = backtrace(frames, StackDepth);
+          entry.stack.assign(frames, frames + depth);
+        }
+        Shard &shard = m_shards[shardIndex(block)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries[block] = std::move(entry); // Replaces a block deleted while tracking was off
+      }
+
+      void disposed(const void *block)
+      {
+        Shard &shard = m_shards[shardIndex(block)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(block);
+        if (it != shard.entries.end())
+        {
+          it->second.weakOnly = true;
+        }
+      }
+
+      void deleted(const void *block)
+      {
+        Shard &shard = m_shards[shardIndex(block)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.erase(block);
+      }
+
+      std::vector<RetainedBlock> snapshot(bool weakOnly)
+      {
+        std::vector<RetainedBlock> blocks;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (Shard &shard : m_shards)
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          for (const auto &item : shard.entries)
+          {
+            const Entry &entry = item.second;
+            if (weakOnly && !entry.weakOnly)
+            {
+              continue;
+            }
+            std::size_t bytes = entry.blockBytes + (entry.weakOnly ? 0 : entry.objectBytes);
+            blocks.push_back({item.first, demangle(entry.type->name()), bytes, now - entry.created, entry.weakOnly, entry.site, entry.stack});
+          }
+        }
+        return blocks;
+      }
+
+      void clear()
+      {
+        for (Shard &shard : m_shards)
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          shard.entries.clear();
+        }
+      }
+
+    private:
+      struct Entry
+      {
+        const std::type_info *type;
+        std::size_t objectBytes; // Allocated apart from the block, freed with the object
+        std::size_t blockBytes;
+        std::chrono::steady_clock::time_point created;
+        bool weakOnly;
+        void *site;
+        std::vector<void *> stack;
+      };
+
+      struct alignas(64) Shard
+      {
+        std::mutex mutex;
+        std::unordered_map<const void *, Entry> entries;
+      };
+
+      Shard m_shards[Shards];
+
+      static std::size_t shardIndex(const void *block)
+      {
+        return (reinterpret_cast<std::uintptr_t>(block) >> 6) % Shards;
+      }
+    };
+
+    /**
+     * @brief Record a block created by a Shared constructor or makeShared called from site
+     */
+    template <typename Block>
+    inline void trackCreated(Block *block, const std::type_info &type, std::size_t objectBytes, void *site)
+    {
+      RetentionRegistry &registry = RetentionRegistry::instance();
+      if (registry.enabled.load(std::memory_order_relaxed))
+      {
+        registry.created(block, type, objectBytes, sizeof(Block), site);
+      }
+    }
+
+    /**
+     * @brief Mark the object of a block destroyed, the block is kept only if Weak pointers remain
+     */
+    template <typename Block>
+    inline void trackDisposed(Block *block)
+    {
+      RetentionRegistry &registry = RetentionRegistry::instance();
+      // the weak count only holds the reference of the Shared group when no Weak pointer is left
+      if (registry.enabled.load(std::memory_order_relaxed) && block->weakCount.load(std::memory_order_relaxed) > 1)
+      {
+        registry.disposed(block);
+      }
+    }
+
+    /**
+     * @brief Forget a deleted block
+     */
+    inline void trackDeleted(const void *block)
+    {
+      RetentionRegistry &registry = RetentionRegistry::instance();
+      if (registry.enabled.load(std::memory_order_relaxed))
+      {
+        registry.deleted(block);
+      }
+    }
+
+  } // namespace detail
+
+  /**
+   * @brief Control and queries of the live Shared control blocks
+   *
+   * Only the blocks created since start() are known, start it early to see long-lived objects.
+   * Sizes are the sizeof of the block and of the object, not the memory the object owns.
+   */
+  class RetentionTracker
+  {
+  public:
+    /**
+     * @brief Start tracking the blocks created from now on, sampling one creation stack in stackPeriod
+     */
+    static void start(std::uint32_t stackPeriod = 0)
+    {
+      detail::RetentionRegistry &registry = detail::RetentionRegistry::instance();
+      registry.stackPeriod.store(stackPeriod, std::memory_order_relaxed);
+      registry.enabled.store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Stop tracking and forget every block, their deletions are no longer seen
+     */
+    static void stop()
+    {
+      detail::RetentionRegistry &registry = detail::RetentionRegistry::instance();
+      registry.enabled.store(false, std::memory_order_relaxed);
+      registry.clear();
+    }
+
+    /**
+     * @brief Check if tracking is on
+     */
+    static bool running()
+    {
+      return detail::RetentionRegistry::instance().enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the live blocks holding the most memory
+     *
+     * @return std::vector<RetainedBlock> largest first
+     */
+    static std::vector<RetainedBlock> largest(std::size_t count = 20)
+    {
+      return top(detail::RetentionRegistry::instance().snapshot(false), count, byBytes);
+    }
+
+    /**
+     * @brief Get the live blocks created the longest time ago
+     *
+     * @return std::vector<RetainedBlock> oldest first
+     */
+    static std::vector<RetainedBlock> oldest(std::size_t count = 20)
+    {
+      return top(detail::RetentionRegistry::instance().snapshot(false), count, [](const RetainedBlock &a, const RetainedBlock &b)
+                 { return a.age > b.age; });
+    }
+
+    /**
+     * @brief Get the blocks whose object is destroyed but that Weak pointers keep allocated
+     *
+     * @return std::vector<RetainedBlock> largest first
+     */
+    static std::vector<RetainedBlock> weakOnly(std::size_t count = 20)
+    {
+      return top(detail::RetentionRegistry::instance().snapshot(true), count, byBytes);
+    }
+
+    /**
+     * @brief Write the largest, oldest and weak-only blocks to a file
+     *
+     * Sites and stacks are raw return addresses, to resolve with addr2line or a debugger.
+     *
+     * @return bool false if the file could not be written
+     */
+    static bool dump(const std::string &path, std::size_t count = 20)
+    {
+      std::FILE *file = std::fopen(path.c_str(), "w");
+      if (!file)
+      {
+        return false;
+      }
+      std::fprintf(file, "# bytes age_ms weak_only block site type\n");
+      const std::pair<const char *, std::vector<RetainedBlock>> sections[] = {
+          {"largest", largest(count)}, {"oldest", oldest(count)}, {"weak-only", weakOnly(count)}};
+      for (const auto &section : sections)
+      {
+        std::fprintf(file, "[%s]\n", section.first);
+        for (const RetainedBlock &retained : section.second)
+        {
+          long long age = std::chrono::duration_cast<std::chrono::milliseconds>(retained.age).count();
+          std::fprintf(file, "%zu %lld %d %p %p %s\n", retained.bytes, age, retained.weakOnly ? 1 : 0, retained.block, retained.site, retained.type.c_str());
+          for (void *frame : retained.stack)
+          {
+            std::fprintf(file, "  %p\n", frame);
+          }
+        }
+      }
+      return std::fclose(file) == 0;
+    }
+
+  private:
+    static bool byBytes(const RetainedBlock &a, const RetainedBlock &b)
+    {
+      return a.bytes > b.bytes || (a.bytes == b.bytes && a.age > b.age);
+    }
+
+    template <typename Compare>
+    static std::vector<RetainedBlock> top(std::vector<RetainedBlock> blocks, std::size_t count, Compare compare)
+    {
+      count = std::min(count, blocks.size());
+      std::partial_sort(blocks.begin(), blocks.begin() + count, blocks.end(), compare);
+      blocks.resize(count);
+      return blocks;
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_RETENTION_H
@@ -1,23 +1,578 @@
 #ifndef SP_SHARED_H
 #define SP_SHARED_H
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <utility>
 #include <map>
+#include <new>
 #include <stdexcept> // Include for std::runtime_error
+#include <type_traits>
 
-namespace sp
-{
+#include "Abi.h"
+#include "Hazard.h"
+#include "Pool.h"
+
+#ifdef SP_PROFILE_CONTENTION
+#include "Contention.h"
+#else
+#define SP_PROFILE_COUNT(T, block, site) ((void)(site))
+#endif
+
+#ifdef SP_TRACK_RETENTION
+#include "Retention.h"
+#else
+#define SP_TRACK_CREATED(T, block, objectBytes, site) ((void)(site))
+#define SP_TRACK_DISPOSED(block) ((void)0)
+#define SP_TRACK_DELETED(block) ((void)0)
+#endif
+
+#ifdef SP_CHECKED
+#include "Checked.h"
+#else
+#define SP_CHECK_BLOCK(block, operation) ((void)0)
+#endif
+
+#if defined(SP_PROFILE_CONTENTION) || defined(SP_TRACK_RETENTION)
+// entry points reporting their caller are not inlined, so that their return address is in the calling code
+#define SP_CALLER_ENTRY [[gnu::noinline]]
+#define SP_CALLER __builtin_return_address(0)
+#else
+#define SP_CALLER_ENTRY
+#define SP_CALLER nullptr
+#endif
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Declare whether Weak pointers may observe a type, specialize it with NoWeak to opt out
+   *
+   * The control blocks of a no-weak type carry no weak count, and the last Shared release deletes
+   * the object and its block together. Constructing a Weak pointer on such a type does not compile.
+   */
+  template <typename T>
+  struct WeakTraits
+  {
+    static constexpr bool enabled = true;
+  };
+
+  // base of the WeakTraits specializations of types never observed by Weak pointers
+  struct NoWeak
+  {
+    static constexpr bool enabled = false;
+  };
+
+  /**
+   * @brief Declare whether sp::DeferredCounts may batch the Shared counts of a type
+   *
+   * Off by default, a copy or a release is then a single atomic operation and never looks at the
+   * thread-local buffer of DeferredCounts. Specialize it with DeferredEnabled for the types copied
+   * and dropped in hot loops.
+   *
+   * @note usage example: template <> struct sp::DeferredTraits<Node> : sp::DeferredEnabled {};
+   */
+  template <typename T>
+  struct DeferredTraits
+  {
+    static constexpr bool enabled = false;
+  };
 
-  // a struct to keep track of the reference count and weak count
+  // base of the DeferredTraits specializations of types whose counts may be batched
+  struct DeferredEnabled
+  {
+    static constexpr bool enabled = true;
+  };
+
+  // a struct to keep track of the reference count
+  // the count is atomic so that copies of the same Shared may be made and dropped from several threads at once
   struct BlockControl
   {
-    std::size_t refCount = 0;  // Count of Shared pointers
-    std::size_t weakCount = 0; // Count of Weak pointers
+    // high bit of refCount, set for good once a hazard pointer may protect the block
+    static constexpr std::size_t HazardFlag = ~(~std::size_t(0) >> 1);
+
+    std::atomic<std::size_t> refCount; // Count of Shared pointers, plus HazardFlag
+
+    BlockControl() : refCount(1) {} // Initialize refCount to 1 for the first Shared pointer
+
+#ifdef SP_CHECKED
+    std::uint32_t checkMagic = detail::BlockAlive; // Poisoned with the counts when the block is deleted
+#endif
+
+    virtual ~BlockControl()
+    {
+      SP_TRACK_DELETED(this);
+#ifdef SP_CHECKED
+      // volatile so that the stores are not dropped as dead, the memory is quarantined afterwards
+      *static_cast<volatile std::uint32_t *>(&checkMagic) = detail::BlockFreed;
+      refCount.store(detail::PoisonedCount, std::memory_order_relaxed);
+#endif
+    }
+
+#ifdef SP_CHECKED
+    // deleted blocks are kept in the quarantine of the thread for a while instead of being freed
+    static void operator delete(void *memory)
+    {
+      detail::quarantineBlock(memory, 0);
+    }
+
+    static void operator delete(void *memory, std::align_val_t align)
+    {
+      detail::quarantineBlock(memory, static_cast<std::size_t>(align));
+    }
+#endif
+
+    /**
+     * @brief Delete the managed object
+     */
+    virtual void dispose() = 0;
+
+    /**
+     * @brief Get the address of the managed object, still valid as a value once it is deleted
+     */
+    virtual void *address() = 0;
+
+    /**
+     * @brief Add a Shared reference
+     */
+    void addRef()
+    {
+      refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Add a Shared reference only if the object is still alive
+     *
+     * @return bool true if the reference was taken
+     */
+    bool tryAddRef()
+    {
+      std::size_t count = refCount.load(std::memory_order_relaxed);
+      while ((count & ~HazardFlag) != 0)
+      {
+        if (refCount.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * @brief Drop one or several Shared references
+     *
+     * @return bool true if they were the last ones and the object must be deleted
+     */
+    bool releaseRef(std::size_t count = 1)
+    {
+      std::size_t previous = refCount.fetch_sub(count, std::memory_order_acq_rel) & ~HazardFlag;
+#ifdef SP_CHECKED
+      if (previous < count)
+      {
+        detail::checkFailed("Shared reference released more times than it was taken");
+      }
+#endif
+      return previous == count;
+    }
+
+    /**
+     * @brief Get the number of Shared references
+     */
+    std::size_t useCount() const
+    {
+      return refCount.load(std::memory_order_acquire) & ~HazardFlag;
+    }
+
+    /**
+     * @brief Flag the block as reachable by hazard pointers, the caller holds a reference on it
+     *
+     * The flag lives in the count word, so the decrement that drops the last reference after it
+     * sees it. Only flagged blocks pay for a scan of the hazard slots when they are released.
+     */
+    void markHazardous()
+    {
+      if (!hazardous())
+      {
+        refCount.fetch_or(HazardFlag, std::memory_order_relaxed);
+      }
+    }
+
+    /**
+     * @brief Check if a hazard pointer may protect the block
+     */
+    bool hazardous() const
+    {
+      return refCount.load(std::memory_order_relaxed) & HazardFlag;
+    }
+
+    /**
+     * @brief Delete the object after its last Shared reference, and the block if nothing else needs it
+     */
+    virtual void release()
+    {
+      dispose();
+      delete this;
+    }
+
+    /**
+     * @brief Delete the object after its last Shared reference, unless a hazard pointer protects it
+     */
+    void releaseObject()
+    {
+      if (hazardous() && detail::HazardDomain::instance().isProtectedAfterRelease(this))
+      {
+        detail::HazardDomain::instance().retire(this, &BlockControl::reclaim);
+      }
+      else
+      {
+        release();
+      }
+    }
+
+  private:
+    static void reclaim(void *ptr)
+    {
+      static_cast<BlockControl *>(ptr)->release();
+    }
+  };
+
+  // a control block Weak pointers may observe, it outlives the object until the last of them is gone
+  struct WeakBlockControl : BlockControl
+  {
+    std::atomic<std::size_t> weakCount; // Count of Weak pointers, plus one held by the Shared pointers as a group
+
+    WeakBlockControl() : weakCount(1) {}
+
+#ifdef SP_CHECKED
+    ~WeakBlockControl() override
+    {
+      weakCount.store(detail::PoisonedCount, std::memory_order_relaxed);
+    }
+#endif
+
+    /**
+     * @brief Add a Weak reference
+     */
+    void addWeak()
+    {
+      weakCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Add a Weak reference only if the block is still referenced
+     *
+     * @return bool true if the reference was taken
+     */
+    bool tryAddWeak()
+    {
+      std::size_t count = weakCount.load(std::memory_order_relaxed);
+      while (count != 0)
+      {
+        if (weakCount.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * @brief Drop a Weak reference
+     *
+     * @return bool true if it was the last one and the block must be deleted
+     */
+    bool releaseWeak()
+    {
+      std::size_t previous = weakCount.fetch_sub(1, std::memory_order_acq_rel);
+#ifdef SP_CHECKED
+      if (previous == 0)
+      {
+        detail::checkFailed("Weak reference released more times than it was taken");
+      }
+#endif
+      return previous == 1;
+    }
+
+    /**
+     * @brief Delete the block after its last Weak reference, unless a hazard pointer still points at it
+     */
+    void releaseBlock()
+    {
+      // a block published in an AtomicWeak slot was flagged before, the flag is seen through the weak count
+      if (hazardous() && detail::HazardDomain::instance().isProtectedAfterRelease(this))
+      {
+        detail::HazardDomain::instance().retire(this, &WeakBlockControl::destroy);
+      }
+      else
+      {
+        delete this;
+      }
+    }
+
+    /**
+     * @brief Delete the object and drop the weak reference held by the Shared pointers
+     */
+    void release() override
+    {
+      dispose();
+      SP_TRACK_DISPOSED(this);
+      if (releaseWeak())
+      {
+        releaseBlock();
+      }
+    }
+
+  private:
+    static void destroy(void *ptr)
+    {
+      delete static_cast<WeakBlockControl *>(ptr);
+    }
+  };
+
+  namespace detail
+  {
+    struct BulkRelease;
+
+    // the control block base of a type, with a weak count only if Weak pointers may observe it
+    template <typename T>
+    using BlockBase = std::conditional_t<WeakTraits<T>::enabled, WeakBlockControl, BlockControl>;
+
+    // allocation functions of the control blocks of a pooled type, taken from a pool of the block type
+    template <typename Block, bool Pooled>
+    struct PooledBlock
+    {
+    };
+
+#ifndef SP_CHECKED // Checked builds quarantine every deleted block instead
+    template <typename Block>
+    struct PooledBlock<Block, true>
+    {
+      static void *operator new(std::size_t)
+      {
+        return ObjectPool<Block>::allocate();
+      }
+
+      static void operator delete(void *ptr)
+      {
+        ObjectPool<Block>::deallocate(ptr);
+      }
+    };
+#endif
+  } // namespace detail
+
+  // a control block owning an object allocated separately, pooled along with its object type
+  template <typename T>
+  struct PointerBlock final : detail::BlockBase<T>, detail::PooledBlock<PointerBlock<T>, PoolTraits<T>::enabled>
+  {
+    T *ptr;
+
+    PointerBlock(T *ptr) : ptr(ptr) {}
 
-    BlockControl() : refCount(1), weakCount(0) {} // Initialize refCount to 1 for the first Shared pointer
+    void dispose() override
+    {
+      detail::deleteObject(ptr);
+    }
+
+    void *address() override
+    {
+      return ptr;
+    }
   };
 
+  // a control block holding its object, one allocation but the object memory lives as long as the block
+  template <typename T>
+  struct InplaceBlock final : detail::BlockBase<T>, detail::PooledBlock<InplaceBlock<T>, PoolTraits<T>::enabled>
+  {
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    template <typename... Args>
+    InplaceBlock(Args &&...args)
+    {
+      new (storage) T(std::forward<Args>(args)...);
+    }
+
+    T *object()
+    {
+      return reinterpret_cast<T *>(storage);
+    }
+
+    void dispose() override
+    {
+      object()->~T();
+    }
+
+    void *address() override
+    {
+      return storage;
+    }
+  };
+
+  // the control blocks of a pooled type are pooled with the same settings
+  template <typename T>
+  struct PoolTraits<PointerBlock<T>> : PoolTraits<T>
+  {
+  };
+
+  template <typename T>
+  struct PoolTraits<InplaceBlock<T>> : PoolTraits<T>
+  {
+  };
+
+#ifndef SP_SHARED_FUSED_THRESHOLD
+#define SP_SHARED_FUSED_THRESHOLD 256 // Largest object makeShared places inside its control block
+#endif // SP_SHARED_FUSED_THRESHOLD
+
+  /**
+   * @brief Layout chosen by makeShared, specialize it to override the threshold for a type
+   *
+   * Small objects are fused with their control block for locality. Large ones get their own
+   * allocation, freed as soon as the last Shared goes away even if Weak pointers keep the block.
+   * The blocks of a pooled type come from pools of their own, with the settings of the type.
+   */
+  template <typename T>
+  struct SharedLayout
+  {
+    static constexpr bool fused = sizeof(T) <= SP_SHARED_FUSED_THRESHOLD;
+
+    // bytes kept allocated by Weak pointers once the object is destroyed
+    static constexpr std::size_t retainedBytes = !WeakTraits<T>::enabled ? 0 : fused ? sizeof(InplaceBlock<T>) : sizeof(PointerBlock<T>);
+  };
+
+  namespace detail
+  {
+
+    /**
+     * @brief Hash a control block address, the low bits are always zero and the others are mixed
+     */
+    inline std::size_t hashOwner(const BlockControl *block)
+    {
+      std::uint64_t value = reinterpret_cast<std::uintptr_t>(block) >> 4;
+      value ^= value >> 33;
+      value *= 0xff51afd7ed558ccdULL;
+      value ^= value >> 33;
+      return static_cast<std::size_t>(value);
+    }
+
+    // the Shared decrements a thread has not applied yet, installed by sp::DeferredCounts
+    // an increment on a block with a pending decrement cancels it, so copy-and-drop loops touch no counter
+    struct RefBuffer
+    {
+      static constexpr std::size_t Capacity = 32;
+
+      struct Entry
+      {
+        BlockControl *block;
+        std::size_t pending; // Decrements not applied yet
+      };
+
+      Entry entries[Capacity];
+      std::size_t size = 0;
+
+      /**
+       * @brief Take back a pending decrement instead of incrementing the count
+       *
+       * @return bool false if no decrement is pending for the block
+       */
+      bool cancel(BlockControl *block)
+      {
+        for (std::size_t i = size; i-- > 0;)
+        {
+          if (entries[i].block == block)
+          {
+            if (--entries[i].pending == 0)
+            {
+              entries[i] = entries[--size];
+            }
+            return true;
+          }
+        }
+        return false;
+      }
+
+      /**
+       * @brief Log a decrement, the buffer is flushed when it is full
+       */
+      void defer(BlockControl *block)
+      {
+        for (std::size_t i = size; i-- > 0;)
+        {
+          if (entries[i].block == block)
+          {
+            ++entries[i].pending;
+            return;
+          }
+        }
+        if (size == Capacity)
+        {
+          flush();
+        }
+        entries[size++] = {block, 1};
+      }
+
+      /**
+       * @brief Apply every pending decrement, objects whose count reaches zero are deleted
+       *
+       * @note deleting an object may defer new decrements, they are applied by the same loop
+       */
+      void flush()
+      {
+        while (size > 0)
+        {
+          Entry entry = entries[--size];
+          if (entry.block->releaseRef(entry.pending))
+          {
+            entry.block->releaseObject();
+          }
+        }
+      }
+    };
+
+    inline RefBuffer *&refBuffer()
+    {
+      static thread_local RefBuffer *buffer = nullptr;
+      return buffer;
+    }
+
+    /**
+     * @brief Add a Shared reference, or cancel a pending decrement of the current thread
+     */
+    template <typename T>
+    inline void acquireShared(BlockControl *block)
+    {
+      if constexpr (DeferredTraits<T>::enabled)
+      {
+        RefBuffer *buffer = refBuffer();
+        if (buffer && buffer->cancel(block))
+        {
+          return;
+        }
+      }
+      block->addRef();
+    }
+
+    /**
+     * @brief Drop a Shared reference, or log it if the current thread defers its decrements
+     */
+    template <typename T>
+    inline void releaseShared(BlockControl *block)
+    {
+      if constexpr (DeferredTraits<T>::enabled)
+      {
+        if (RefBuffer *buffer = refBuffer())
+        {
+          buffer->defer(block);
+          return;
+        }
+      }
+      if (block->releaseRef())
+      {
+        block->releaseObject();
+      }
+    }
+
+  } // namespace detail
+
   ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
   /**
@@ -30,12 +585,11 @@ namespace sp
     /**
      * @brief Constructor takes a dynamic pointer
      */
-    Shared(T *ptr = nullptr)
+    SP_CALLER_ENTRY Shared(T *ptr = nullptr)
     {
       if (ptr)
       {
-        m_ptr = ptr;
-        m_block = new BlockControl(); // Create a new BlockControl instance
+        own(ptr, SP_CALLER);
       }
       else
       {
@@ -45,16 +599,9 @@ namespace sp
     }
 
     // Destructor
-    ~Shared()
+    SP_CALLER_ENTRY ~Shared()
     {
-      if (m_block && --(m_block->refCount) == 0)
-      {
-        delete m_ptr;
-        if (m_block->weakCount == 0)
-        {
-          delete m_block;
-        }
-      }
+      releaseResources(SP_CALLER);
     }
 
     // Move constructor
@@ -65,11 +612,11 @@ namespace sp
     }
 
     // Move assignment operator
-    Shared &operator=(Shared &&other) noexcept
+    SP_CALLER_ENTRY Shared &operator=(Shared &&other) noexcept
     {
       if (this != &other)
       {
-        releaseResources();
+        releaseResources(SP_CALLER);
         m_ptr = other.m_ptr;
         m_block = other.m_block;
         other.m_ptr = nullptr;
@@ -79,25 +626,29 @@ namespace sp
     }
 
     // Copy constructor
-    Shared(const Shared &other) : m_block(other.m_block), m_ptr(other.m_ptr)
+    SP_CALLER_ENTRY Shared(const Shared &other) : m_block(other.m_block), m_ptr(other.m_ptr)
     {
       if (m_block)
       {
-        ++(m_block->refCount);
+        SP_CHECK_BLOCK(m_block, "Shared copy");
+        SP_PROFILE_COUNT(T, m_block, SP_CALLER);
+        detail::acquireShared<T>(m_block);
       }
     }
 
     // Copy assignment operator
-    Shared &operator=(const Shared &other)
+    SP_CALLER_ENTRY Shared &operator=(const Shared &other)
     {
       if (this != &other)
       {
-        releaseResources();
+        releaseResources(SP_CALLER);
         m_ptr = other.m_ptr;
         m_block = other.m_block;
         if (m_block)
         {
-          ++(m_block->refCount);
+          SP_CHECK_BLOCK(m_block, "Shared copy");
+          SP_PROFILE_COUNT(T, m_block, SP_CALLER);
+          detail::acquireShared<T>(m_block);
         }
       }
       return *this;
@@ -108,7 +659,7 @@ namespace sp
      *
      * @return T*
      */
-    T *get()
+    T *get() const
     {
       return m_ptr;
     }
@@ -118,10 +669,14 @@ namespace sp
      *
      * @return T&
      */
-    T &operator*()
+    T &operator*() const
     {
       if (m_ptr)
       {
+        if (m_block)
+        {
+          SP_CHECK_BLOCK(m_block, "Dereference");
+        }
         return *m_ptr;
       }
       throw std::runtime_error("Null pointer exception");
@@ -132,8 +687,12 @@ namespace sp
      *
      * @return T*
      */
-    T *operator->()
+    T *operator->() const
     {
+      if (m_block)
+      {
+        SP_CHECK_BLOCK(m_block, "Dereference");
+      }
       return m_ptr;
     }
 
@@ -144,7 +703,49 @@ namespace sp
      */
     std::size_t count() const
     {
-      return m_block ? m_block->refCount : 0;
+      return m_block ? m_block->useCount() : 0;
+    }
+
+    /**
+     * @brief Get the control block, identifies the owned object without touching the counts
+     *
+     * @return const BlockControl*
+     */
+    const BlockControl *owner() const
+    {
+      return m_block;
+    }
+
+    /**
+     * @brief Order by owner, the same order for every Shared and Weak pointer on the same object
+     *
+     * @return bool
+     */
+    template <typename Pointer>
+    bool ownerBefore(const Pointer &other) const
+    {
+      return std::less<const BlockControl *>()(m_block, other.owner());
+    }
+
+    /**
+     * @brief Check if both pointers share the same owner
+     *
+     * @return bool
+     */
+    template <typename Pointer>
+    bool ownerEqual(const Pointer &other) const
+    {
+      return m_block == other.owner();
+    }
+
+    /**
+     * @brief Hash of the owner
+     *
+     * @return std::size_t
+     */
+    std::size_t ownerHash() const
+    {
+      return detail::hashOwner(m_block);
     }
 
     /**
@@ -173,9 +774,20 @@ namespace sp
      * @note usage example: sp::Shared<T> uniquePtr = sp::Shared<T>::makeShared<T>(*T);
      */
     template <typename... Args>
-    static Shared makeShared(Args &&...args)
+    SP_CALLER_ENTRY static Shared makeShared(Args &&...args)
     {
-      return Shared(new T(std::forward<Args>(args)...));
+      if constexpr (SharedLayout<T>::fused)
+      {
+        auto *block = new InplaceBlock<T>(std::forward<Args>(args)...);
+        SP_TRACK_CREATED(T, block, 0, SP_CALLER);
+        return Shared(block->object(), block);
+      }
+      else
+      {
+        Shared shared;
+        shared.own(detail::newObject<T>(std::forward<Args>(args)...), SP_CALLER);
+        return shared;
+      }
     }
 
     /**
@@ -183,9 +795,9 @@ namespace sp
      *
      * @return Weak<T>
      */
-    void reset()
+    SP_CALLER_ENTRY void reset()
     {
-      releaseResources();
+      releaseResources(SP_CALLER);
       m_ptr = nullptr;
       m_block = nullptr;
     }
@@ -193,36 +805,57 @@ namespace sp
   private:
     template <typename U>
     friend class Weak; // Allow Weak to access private members
+    template <typename U>
+    friend class AtomicWeak; // Allow AtomicWeak to adopt the references it takes
+    friend struct detail::BulkRelease; // Allow releaseAll to take the references out of a range
     BlockControl *m_block = nullptr;
     T *m_ptr = nullptr;
 
     /**
-     * @brief Release the resources
+     * @brief Release the resources, site is the code releasing them when the profiler needs it
     */
-    void releaseResources()
+    void releaseResources(void *site)
     {
-      if (m_block && --(m_block->refCount) == 0)
+      if (m_block)
       {
-        delete m_ptr;
-        if (m_block->weakCount == 0)
-        {
-          delete m_block;
-        }
+        SP_CHECK_BLOCK(m_block, "Shared release");
+        SP_PROFILE_COUNT(T, m_block, site);
+        detail::releaseShared<T>(m_block);
       }
     }
 
     /**
-     * @brief Private constructor
+     * @brief Own a new object, site is the code creating it when the retention tracker needs it
+     */
+    void own(T *ptr, void *site)
+    {
+      m_ptr = ptr;
+      auto *block = new PointerBlock<T>(ptr); // Create a new BlockControl instance
+      SP_TRACK_CREATED(T, block, sizeof(T), site);
+      m_block = block;
+    }
+
+    /**
+     * @brief Private constructor, adopts a reference already taken on the block
      */
     Shared(T *ptr, BlockControl *block) : m_block(block), m_ptr(ptr)
     {
-      if (m_block)
-      {
-        ++m_block->refCount;
-      }
     }
   };
 
-} // namespace sp
+SP_END_NAMESPACE
+
+// hashing by owner, consistent with ownerEqual
+namespace std
+{
+  template <typename T>
+  struct hash<sp::Shared<T>>
+  {
+    std::size_t operator()(const sp::Shared<T> &shared) const
+    {
+      return shared.ownerHash();
+    }
+  };
+} // namespace std
 
 #endif // SP_SHARED_H
@@ -0,0 +1,310 @@
+#ifndef SP_STRIPED_H
+#define SP_STRIPED_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include "Abi.h"
+
+SP_BEGIN_NAMESPACE
+
+  namespace detail
+  {
+
+    // one stripe of a sharded count, on its own cache line
+    // the count moves by steps of 2, the low bit marks a stripe that has been folded into the central count
+    struct alignas(64) CountStripe
+    {
+      std::atomic<std::intptr_t> count{0};
+    };
+
+    /**
+     * @brief Get the stripe index of the current thread
+     */
+    inline std::size_t stripeIndex()
+    {
+      static std::atomic<std::size_t> nextIndex{0};
+      static thread_local std::size_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+      return index;
+    }
+
+    // a control block whose reference count is spread over several cache lines
+    template <typename T>
+    struct StripedBlock
+    {
+      static constexpr std::size_t Stripes = 16;
+      static constexpr std::intptr_t Bias = INTPTR_MAX / 2;
+
+      CountStripe stripes[Stripes];
+      alignas(64) std::atomic<std::intptr_t> central{1}; // References taken once folded, plus the one of the base handle
+      T *ptr;
+
+      StripedBlock(T *ptr) : ptr(ptr) {}
+
+      /**
+       * @brief Add a reference on the stripe of the current thread, or on the central count once folded
+       */
+      void addRef()
+      {
+        if (!updateStripe(2))
+        {
+          central.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+
+      /**
+       * @brief Drop a reference
+       *
+       * @return bool true if it was the last one and the object must be deleted
+       */
+      bool releaseRef()
+      {
+        if (updateStripe(-2))
+        {
+          return false; // The base handle still holds its reference, the sum cannot be zero
+        }
+        return central.fetch_sub(1, std::memory_order_acq_rel) == 1;
+      }
+
+      /**
+       * @brief Drop the reference of the base handle, the stripes are summed into the central count
+       *
+       * @return bool true if it was the last one and the object must be deleted
+       */
+      bool releaseBase()
+      {
+        // the bias keeps the central count from reaching zero while the stripes are being folded
+        central.fetch_add(Bias, std::memory_order_relaxed);
+        std::intptr_t sum = 0;
+        for (auto &stripe : stripes)
+        {
+          sum += stripe.count.fetch_or(1, std::memory_order_acq_rel) / 2;
+        }
+        return central.fetch_add(sum - Bias - 1, std::memory_order_acq_rel) == Bias + 1 - sum;
+      }
+
+      /**
+       * @brief Get the reference count, summed over every stripe
+       */
+      std::size_t count() const
+      {
+        std::intptr_t sum = central.load(std::memory_order_acquire);
+        for (const auto &stripe : stripes)
+        {
+          std::intptr_t value = stripe.count.load(std::memory_order_acquire);
+          if (!(value & 1))
+          {
+            sum += value / 2;
+          }
+        }
+        return sum > 0 ? static_cast<std::size_t>(sum) : 0;
+      }
+
+    private:
+      /**
+       * @brief Update the stripe of the current thread
+       *
+       * @return bool false if the stripe has been folded and the central count must be used
+       */
+      bool updateStripe(std::intptr_t delta)
+      {
+        std::atomic<std::intptr_t> &stripe = stripes[stripeIndex() % Stripes].count;
+        std::intptr_t value = stripe.load(std::memory_order_relaxed);
+        while (!(value & 1))
+        {
+          if (stripe.compare_exchange_weak(value, value + delta, std::memory_order_acq_rel, std::memory_order_relaxed))
+          {
+            return true;
+          }
+        }
+        return false;
+      }
+    };
+
+  } // namespace detail
+
+  /**
+   * @brief Shared pointer with a sharded reference count, for objects copied by every core
+   *
+   * Copies and releases touch a per-thread stripe of the count. The handle created by makeShared
+   * is the base handle: while it lives the count cannot reach zero, so the stripes are never summed.
+   * When it is released the stripes are folded into a single atomic count used from then on.
+   */
+  template <typename T>
+  class StripedShared
+  {
+  public:
+    /**
+     * @brief Constructor takes a dynamic pointer, the new handle is the base handle
+     */
+    StripedShared(T *ptr = nullptr)
+        : m_block(ptr ? new detail::StripedBlock<T>(ptr) : nullptr), m_ptr(ptr), m_base(ptr != nullptr)
+    {
+    }
+
+    // Destructor
+    ~StripedShared()
+    {
+      releaseResources();
+    }
+
+    // Copy constructor, copies are never base handles
+    StripedShared(const StripedShared &other) : m_block(other.m_block), m_ptr(other.m_ptr), m_base(false)
+    {
+      if (m_block)
+      {
+        m_block->addRef();
+      }
+    }
+
+    // Copy assignment operator
+    StripedShared &operator=(const StripedShared &other)
+    {
+      if (this != &other)
+      {
+        releaseResources();
+        m_block = other.m_block;
+        m_ptr = other.m_ptr;
+        m_base = false;
+        if (m_block)
+        {
+          m_block->addRef();
+        }
+      }
+      return *this;
+    }
+
+    // Move constructor
+    StripedShared(StripedShared &&other) noexcept : m_block(other.m_block), m_ptr(other.m_ptr), m_base(other.m_base)
+    {
+      other.m_block = nullptr;
+      other.m_ptr = nullptr;
+      other.m_base = false;
+    }
+
+    // Move assignment operator
+    StripedShared &operator=(StripedShared &&other) noexcept
+    {
+      if (this != &other)
+      {
+        releaseResources();
+        m_block = other.m_block;
+        m_ptr = other.m_ptr;
+        m_base = other.m_base;
+        other.m_block = nullptr;
+        other.m_ptr = nullptr;
+        other.m_base = false;
+      }
+      return *this;
+    }
+
+    /**
+     * @brief Get the raw pointer
+     *
+     * @return T*
+     */
+    T *get() const
+    {
+      return m_ptr;
+    }
+
+    /**
+     * @brief Get a reference on pointed data
+     *
+     * @return T&
+     */
+    T &operator*() const
+    {
+      if (m_ptr)
+      {
+        return *m_ptr;
+      }
+      throw std::runtime_error("Null pointer exception");
+    }
+
+    /**
+     * @brief Get the raw pointer
+     *
+     * @return T*
+     */
+    T *operator->() const
+    {
+      return m_ptr;
+    }
+
+    /**
+     * @brief Get the reference count, summed over every stripe
+     *
+     * @return std::size_t
+     */
+    std::size_t count() const
+    {
+      return m_block ? m_block->count() : 0;
+    }
+
+    /**
+     * @brief Check if the raw pointer exists
+     *
+     * @return bool
+     */
+    bool exists() const
+    {
+      return m_ptr != nullptr;
+    }
+
+    /**
+     * @brief Check if the raw pointer exists
+     *
+     * @return bool
+     */
+    operator bool() const
+    {
+      return exists();
+    }
+
+    /**
+     * @brief make a striped shared pointer
+     *
+     * @note usage example: sp::StripedShared<T> logger = sp::StripedShared<T>::makeShared(args...);
+     */
+    template <typename... Args>
+    static StripedShared makeShared(Args &&...args)
+    {
+      return StripedShared(new T(std::forward<Args>(args)...));
+    }
+
+    /**
+     * @brief Release the pointer
+     */
+    void reset()
+    {
+      releaseResources();
+    }
+
+  private:
+    detail::StripedBlock<T> *m_block = nullptr;
+    T *m_ptr = nullptr;
+    bool m_base = false; // Holds the reference that keeps the count in striped mode
+
+    /**
+     * @brief Release the resources
+     */
+    void releaseResources()
+    {
+      if (m_block && (m_base ? m_block->releaseBase() : m_block->releaseRef()))
+      {
+        delete m_block->ptr;
+        delete m_block;
+      }
+      m_block = nullptr;
+      m_ptr = nullptr;
+      m_base = false;
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_STRIPED_H
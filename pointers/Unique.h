@@ -1,8 +1,12 @@
 #ifndef SP_UNIQUE_H
 #define SP_UNIQUE_H
 
-namespace sp
-{
+#include <utility>
+
+#include "Abi.h"
+#include "Pool.h"
+
+SP_BEGIN_NAMESPACE
 
   /**
    * @brief Smart unique pointer
@@ -35,7 +39,7 @@ namespace sp
     {
       if (this != &other)
       {
-        delete m_ptr;
+        detail::deleteObject(m_ptr);
         m_ptr = other.m_ptr;
         other.m_ptr = nullptr;
       }
@@ -47,7 +51,7 @@ namespace sp
      */
     ~Unique()
     {
-      delete m_ptr;
+      detail::deleteObject(m_ptr);
     }
 
     // Non-copyable
@@ -102,19 +106,29 @@ namespace sp
     template <typename... Args>
     static Unique makeUnique(Args &&...args)
     {
-      return Unique(new T(std::forward<Args>(args)...));
+      return Unique(detail::newObject<T>(std::forward<Args>(args)...));
     }
 
     void reset()
     {
-      delete m_ptr;
+      detail::deleteObject(m_ptr);
       m_ptr = nullptr;
     }
 
+    /**
+     * @brief Give up the ownership of the raw pointer without deleting it
+     *
+     * @return T* the raw pointer, to be adopted by another Unique
+     */
+    T *release()
+    {
+      return std::exchange(m_ptr, nullptr);
+    }
+
   private:
     // implementation defined
     T *m_ptr;
   };
-}
+SP_END_NAMESPACE
 
 #endif // SP_UNIQUE_H
@@ -0,0 +1,445 @@
+#ifndef SP_VECTOR_H
+#define SP_VECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include "Abi.h"
+#include "Relocatable.h"
+
+SP_BEGIN_NAMESPACE
+
+  /**
+   * @brief Dynamic array that relocates trivially relocatable elements with realloc and memmove
+   *
+   * Growing, inserting and erasing move the elements of such types as raw bytes instead of one
+   * move construction and one destruction each. Other types are moved one at a time.
+   */
+  template <typename T>
+  class Vector
+  {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "Vector elements must not be over-aligned");
+
+    static constexpr bool Relocatable = is_trivially_relocatable<T>::value;
+
+  public:
+    using value_type = T;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    /**
+     * @brief Default constructor, no allocation
+     */
+    Vector() = default;
+
+    /**
+     * @brief Destructor
+     */
+    ~Vector()
+    {
+      clear();
+      std::free(m_data);
+    }
+
+    /**
+     * @brief Copy constructor
+     */
+    Vector(const Vector &other)
+    {
+      reserve(other.m_size);
+      for (const T &value : other)
+      {
+        push_back(value);
+      }
+    }
+
+    /**
+     * @brief Copy assignment
+     */
+    Vector &operator=(const Vector &other)
+    {
+      if (this != &other)
+      {
+        Vector copy(other);
+        swap(copy);
+      }
+      return *this;
+    }
+
+    /**
+     * @brief Move constructor
+     */
+    Vector(Vector &&other) noexcept
+    {
+      swap(other);
+    }
+
+    /**
+     * @brief Move assignment
+     */
+    Vector &operator=(Vector &&other) noexcept
+    {
+      if (this != &other)
+      {
+        Vector moved(std::move(other));
+        swap(moved);
+      }
+      return *this;
+    }
+
+    /**
+     * @brief Swap the content of two vectors
+     */
+    void swap(Vector &other) noexcept
+    {
+      std::swap(m_data, other.m_data);
+      std::swap(m_size, other.m_size);
+      std::swap(m_capacity, other.m_capacity);
+    }
+
+    /**
+     * @brief Get the number of elements
+     */
+    std::size_t size() const
+    {
+      return m_size;
+    }
+
+    /**
+     * @brief Get the number of elements that fit without reallocating
+     */
+    std::size_t capacity() const
+    {
+      return m_capacity;
+    }
+
+    /**
+     * @brief Check if there is no element
+     */
+    bool empty() const
+    {
+      return m_size == 0;
+    }
+
+    T *data()
+    {
+      return m_data;
+    }
+
+    const T *data() const
+    {
+      return m_data;
+    }
+
+    T &operator[](std::size_t index)
+    {
+      return m_data[index];
+    }
+
+    const T &operator[](std::size_t index) const
+    {
+      return m_data[index];
+    }
+
+    iterator begin()
+    {
+      return m_data;
+    }
+
+    iterator end()
+    {
+      return m_data + m_size;
+    }
+
+    const_iterator begin() const
+    {
+      return m_data;
+    }
+
+    const_iterator end() const
+    {
+      return m_data + m_size;
+    }
+
+    T &back()
+    {
+      return m_data[m_size - 1];
+    }
+
+    /**
+     * @brief Make room for at least the given number of elements
+     */
+    void reserve(std::size_t capacity)
+    {
+      if (capacity <= m_capacity)
+      {
+        return;
+      }
+      if constexpr (Relocatable)
+      {
+        void *data = std::realloc(static_cast<void *>(m_data), bytes(capacity));
+        if (!data)
+        {
+          throw std::bad_alloc();
+        }
+        m_data = static_cast<T *>(data);
+      }
+      else
+      {
+        T *data = allocate(capacity);
+        try
+        {
+          moveInto(data);
+        }
+        catch (...)
+        {
+          std::free(data);
+          throw;
+        }
+        std::free(m_data);
+        m_data = data;
+      }
+      m_capacity = capacity;
+    }
+
+    /**
+     * @brief Construct an element at the end, args may refer to an element of the vector
+     */
+    template <typename... Args>
+    T &emplace_back(Args &&...args)
+    {
+      if (m_size < m_capacity)
+      {
+        new (m_data + m_size) T(std::forward<Args>(args)...);
+      }
+      else if constexpr (Relocatable)
+      {
+        // built aside first since the old buffer may be freed by realloc, then relocated as raw bytes
+        alignas(T) unsigned char value[sizeof(T)];
+        new (value) T(std::forward<Args>(args)...);
+        try
+        {
+          reserve(nextCapacity());
+        }
+        catch (...)
+        {
+          reinterpret_cast<T *>(value)->~T();
+          throw;
+        }
+        std::memcpy(static_cast<void *>(m_data + m_size), value, sizeof(T));
+      }
+      else
+      {
+        // built in the new buffer while the old elements are still alive, then they are moved before it
+        std::size_t capacity = nextCapacity();
+        T *data = allocate(capacity);
+        try
+        {
+          new (data + m_size) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+          std::free(data);
+          throw;
+        }
+        try
+        {
+          moveInto(data);
+        }
+        catch (...)
+        {
+          data[m_size].~T();
+          std::free(data);
+          throw;
+        }
+        std::free(m_data);
+        m_data = data;
+        m_capacity = capacity;
+      }
+      return m_data[m_size++];
+    }
+
+    void push_back(const T &value)
+    {
+      emplace_back(value);
+    }
+
+    void push_back(T &&value)
+    {
+      emplace_back(std::move(value));
+    }
+
+    /**
+     * @brief Destroy the last element
+     */
+    void pop_back()
+    {
+      m_data[--m_size].~T();
+    }
+
+    /**
+     * @brief Construct an element before the given position
+     *
+     * @return iterator on the new element
+     */
+    template <typename... Args>
+    iterator emplace(const_iterator position, Args &&...args)
+    {
+      std::size_t index = position - m_data;
+      if (index == m_size)
+      {
+        emplace_back(std::forward<Args>(args)...);
+        return m_data + index;
+      }
+      if constexpr (Relocatable)
+      {
+        // built aside first since args may refer to an element, then relocated as raw bytes
+        alignas(T) unsigned char value[sizeof(T)];
+        new (value) T(std::forward<Args>(args)...);
+        if (m_size == m_capacity)
+        {
+          try
+          {
+            reserve(nextCapacity());
+          }
+          catch (...)
+          {
+            reinterpret_cast<T *>(value)->~T();
+            throw;
+          }
+        }
+        std::memmove(static_cast<void *>(m_data + index + 1), static_cast<const void *>(m_data + index), (m_size - index) * sizeof(T));
+        std::memcpy(static_cast<void *>(m_data + index), value, sizeof(T));
+        ++m_size;
+      }
+      else
+      {
+        T value(std::forward<Args>(args)...);
+        if (m_size == m_capacity)
+        {
+          reserve(nextCapacity());
+        }
+        emplace_back(std::move(m_data[m_size - 1]));
+        for (std::size_t i = m_size - 2; i > index; --i)
+        {
+          m_data[i] = std::move(m_data[i - 1]);
+        }
+        m_data[index] = std::move(value);
+      }
+      return m_data + index;
+    }
+
+    iterator insert(const_iterator position, const T &value)
+    {
+      return emplace(position, value);
+    }
+
+    iterator insert(const_iterator position, T &&value)
+    {
+      return emplace(position, std::move(value));
+    }
+
+    /**
+     * @brief Destroy the element at the given position
+     *
+     * @return iterator on the element that followed it
+     */
+    iterator erase(const_iterator position)
+    {
+      std::size_t index = position - m_data;
+      if constexpr (Relocatable)
+      {
+        m_data[index].~T();
+        std::memmove(static_cast<void *>(m_data + index), static_cast<const void *>(m_data + index + 1), (m_size - index - 1) * sizeof(T));
+        --m_size;
+      }
+      else
+      {
+        for (std::size_t i = index; i + 1 < m_size; ++i)
+        {
+          m_data[i] = std::move(m_data[i + 1]);
+        }
+        pop_back();
+      }
+      return m_data + index;
+    }
+
+    /**
+     * @brief Destroy every element, the capacity is kept
+     */
+    void clear()
+    {
+      while (m_size > 0)
+      {
+        pop_back();
+      }
+    }
+
+  private:
+    T *m_data = nullptr;
+    std::size_t m_size = 0;
+    std::size_t m_capacity = 0;
+
+    std::size_t nextCapacity() const
+    {
+      return m_capacity ? m_capacity * 2 : 4;
+    }
+
+    // size of a buffer of the given capacity, which must not overflow
+    static std::size_t bytes(std::size_t capacity)
+    {
+      if (capacity > SIZE_MAX / sizeof(T))
+      {
+        throw std::length_error("Vector capacity too large");
+      }
+      return capacity * sizeof(T);
+    }
+
+    static T *allocate(std::size_t capacity)
+    {
+      T *data = static_cast<T *>(std::malloc(bytes(capacity)));
+      if (!data)
+      {
+        throw std::bad_alloc();
+      }
+      return data;
+    }
+
+    /**
+     * @brief Build the elements in a new buffer, the old ones are destroyed only once all are built
+     *
+     * A throw destroys the elements built so far and leaves the vector as it was.
+     */
+    void moveInto(T *data)
+    {
+      std::size_t built = 0;
+      try
+      {
+        for (; built < m_size; ++built)
+        {
+          new (data + built) T(std::move_if_noexcept(m_data[built]));
+        }
+      }
+      catch (...)
+      {
+        while (built > 0)
+        {
+          data[--built].~T();
+        }
+        throw;
+      }
+      for (std::size_t i = 0; i < m_size; ++i)
+      {
+        m_data[i].~T();
+      }
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_VECTOR_H
@@ -1,10 +1,10 @@
 #ifndef SP_WEAK_H
 #define SP_WEAK_H
 
+#include "Abi.h"
 #include "Shared.h" // Ensure this includes the updated Shared.h with BlockControl
 
-namespace sp
-{
+SP_BEGIN_NAMESPACE
 
   /**
    * @brief Smart weak pointer
@@ -12,16 +12,18 @@ namespace sp
   template <typename T>
   class Weak
   {
+    static_assert(WeakTraits<T>::enabled, "Weak pointers are disabled for this type by its WeakTraits");
+
   public:
     // Default constructor
     Weak() : m_ptr(nullptr), m_block(nullptr) {}
 
     // Constructor takes a Shared pointer
-    Weak(const Shared<T> &shared) : m_ptr(shared.m_ptr), m_block(shared.m_block)
+    Weak(const Shared<T> &shared) : m_ptr(shared.m_ptr), m_block(static_cast<WeakBlockControl *>(shared.m_block))
     {
       if (m_block)
       {
-        ++(m_block->weakCount); // Increment the weak count
+        m_block->addWeak(); // Increment the weak count
       }
     }
 
@@ -36,7 +38,7 @@ namespace sp
     {
       if (m_block)
       {
-        ++(m_block->weakCount);
+        m_block->addWeak();
       }
     }
 
@@ -50,7 +52,7 @@ namespace sp
         m_block = other.m_block;
         if (m_block)
         {
-          ++(m_block->weakCount);
+          m_block->addWeak();
         }
       }
       return *this;
@@ -78,11 +80,16 @@ namespace sp
     }
 
     // Get a Shared pointer from the Weak pointer
-    Shared<T> lock()
+    SP_CALLER_ENTRY Shared<T> lock() const
     {
-      if (m_block && m_block->refCount > 0)
+      if (m_block)
       {
-        // Using a private constructor of Shared that accepts (T*, BlockControl*)
+        SP_CHECK_BLOCK(m_block, "Weak lock");
+      }
+      if (m_block && m_block->tryAddRef())
+      {
+        SP_PROFILE_COUNT(T, m_block, SP_CALLER);
+        // Using a private constructor of Shared that adopts the reference just taken
         return Shared<T>(m_ptr, m_block);
       }
       else
@@ -94,7 +101,49 @@ namespace sp
     // Check if the Weak pointer is expired
     bool expired() const
     {
-      return m_block == nullptr || m_block->refCount == 0;
+      return m_block == nullptr || m_block->useCount() == 0;
+    }
+
+    /**
+     * @brief Get the control block, identifies the observed object without touching the counts
+     *
+     * @return const BlockControl*
+     */
+    const BlockControl *owner() const
+    {
+      return m_block;
+    }
+
+    /**
+     * @brief Order by owner, the same order for every Shared and Weak pointer on the same object
+     *
+     * @return bool
+     */
+    template <typename Pointer>
+    bool ownerBefore(const Pointer &other) const
+    {
+      return std::less<const BlockControl *>()(m_block, other.owner());
+    }
+
+    /**
+     * @brief Check if both pointers share the same owner, even once expired
+     *
+     * @return bool
+     */
+    template <typename Pointer>
+    bool ownerEqual(const Pointer &other) const
+    {
+      return m_block == other.owner();
+    }
+
+    /**
+     * @brief Hash of the owner
+     *
+     * @return std::size_t
+     */
+    std::size_t ownerHash() const
+    {
+      return detail::hashOwner(m_block);
     }
 
 
@@ -107,8 +156,11 @@ namespace sp
     }
 
   private:
+    friend class HazardGuard; // Allow HazardGuard to protect the observed object
+    template <typename U>
+    friend class AtomicWeak; // Allow AtomicWeak to move references in and out of its slot
     T *m_ptr;
-    BlockControl *m_block;
+    WeakBlockControl *m_block;
 
 
     /**
@@ -116,15 +168,60 @@ namespace sp
      */
     void releaseResources()
     {
-      if (m_block && --(m_block->weakCount) == 0 && m_block->refCount == 0)
+      if (m_block)
+      {
+        SP_CHECK_BLOCK(m_block, "Weak release");
+      }
+      if (m_block && m_block->releaseWeak())
       {
-        delete m_block; // Delete the BlockControl if both refCount and weakCount are 0
+        m_block->releaseBlock(); // Delete the BlockControl once the last Weak and the last Shared are gone
       }
       m_ptr = nullptr;
       m_block = nullptr;
     }
   };
 
-} // namespace sp
+  // owner-based comparison functors, for ordered and hashed containers of Shared and Weak pointers
+  struct OwnerLess
+  {
+    template <typename Pointer1, typename Pointer2>
+    bool operator()(const Pointer1 &lhs, const Pointer2 &rhs) const
+    {
+      return lhs.ownerBefore(rhs);
+    }
+  };
+
+  struct OwnerEqual
+  {
+    template <typename Pointer1, typename Pointer2>
+    bool operator()(const Pointer1 &lhs, const Pointer2 &rhs) const
+    {
+      return lhs.ownerEqual(rhs);
+    }
+  };
+
+  struct OwnerHash
+  {
+    template <typename Pointer>
+    std::size_t operator()(const Pointer &pointer) const
+    {
+      return pointer.ownerHash();
+    }
+  };
+
+SP_END_NAMESPACE
+
+// hashing by owner, consistent with ownerEqual and stable once expired
+namespace std
+{
+  template <typename T>
+  struct hash<sp::Weak<T>>
+  {
+    std::size_t operator()(const sp::Weak<T> &weak) const
+    {
+      return weak.ownerHash();
+    }
+  };
+} // namespace std
 
 #endif // SP_WEAK_H
\ No newline at end of file
@@ -0,0 +1,224 @@
+#ifndef SP_WEAKSET_H
+#define SP_WEAKSET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Abi.h"
+#include "Shared.h"
+#include "Weak.h"
+
+SP_BEGIN_NAMESPACE
+
+  namespace detail
+  {
+
+    // hashes a control block address as the owner hash of a Shared or Weak pointer would
+    struct BlockHash
+    {
+      std::size_t operator()(const BlockControl *block) const
+      {
+        return hashOwner(block);
+      }
+    };
+
+  } // namespace detail
+
+  /**
+   * @brief Set of objects observed through Weak pointers
+   *
+   * Entries are keyed by control block, so lookups never touch the counts. Expired entries are
+   * removed lazily, when an insertion finds the set twice as large as after the last purge.
+   */
+  template <typename T>
+  class WeakSet
+  {
+  public:
+    /**
+     * @brief Add an object
+     *
+     * @return bool true if it was not in the set yet
+     */
+    bool insert(const Shared<T> &shared)
+    {
+      if (!shared.owner())
+      {
+        return false;
+      }
+      maybePurge();
+      // an entry on the same block can only be this object, its Weak keeps the address from being reused
+      auto inserted = m_entries.try_emplace(shared.owner(), shared);
+      return inserted.second;
+    }
+
+    /**
+     * @brief Check if an object is in the set
+     *
+     * @return bool
+     */
+    bool contains(const Shared<T> &shared) const
+    {
+      return m_entries.find(shared.owner()) != m_entries.end();
+    }
+
+    /**
+     * @brief Remove an object
+     *
+     * @return bool true if it was in the set
+     */
+    bool erase(const Shared<T> &shared)
+    {
+      return m_entries.erase(shared.owner()) != 0;
+    }
+
+    /**
+     * @brief Get the number of entries, expired ones included until they are purged
+     *
+     * @return std::size_t
+     */
+    std::size_t size() const
+    {
+      return m_entries.size();
+    }
+
+    /**
+     * @brief Remove every expired entry
+     */
+    void purge()
+    {
+      for (auto it = m_entries.begin(); it != m_entries.end();)
+      {
+        it = it->second.expired() ? m_entries.erase(it) : std::next(it);
+      }
+      m_purgeAt = std::max(MinPurge, m_entries.size() * 2);
+    }
+
+    /**
+     * @brief Get Shared pointers on every object still alive
+     *
+     * @return std::vector<Shared<T>>
+     */
+    std::vector<Shared<T>> lock() const
+    {
+      std::vector<Shared<T>> alive;
+      for (const auto &entry : m_entries)
+      {
+        if (Shared<T> shared = entry.second.lock())
+        {
+          alive.push_back(std::move(shared));
+        }
+      }
+      return alive;
+    }
+
+  private:
+    static constexpr std::size_t MinPurge = 16;
+
+    std::unordered_map<const BlockControl *, Weak<T>, detail::BlockHash> m_entries;
+    std::size_t m_purgeAt = MinPurge;
+
+    void maybePurge()
+    {
+      if (m_entries.size() >= m_purgeAt)
+      {
+        purge();
+      }
+    }
+  };
+
+  /**
+   * @brief Map whose keys are objects observed through Weak pointers
+   *
+   * Same lazy removal of expired keys as WeakSet.
+   */
+  template <typename K, typename V>
+  class WeakMap
+  {
+  public:
+    /**
+     * @brief Get the value of a key, inserted by default if missing
+     *
+     * @return V&
+     */
+    V &operator[](const Shared<K> &key)
+    {
+      maybePurge();
+      auto it = m_entries.find(key.owner());
+      if (it == m_entries.end())
+      {
+        it = m_entries.emplace(key.owner(), Entry{Weak<K>(key), V()}).first;
+      }
+      return it->second.value;
+    }
+
+    /**
+     * @brief Find the value of a key
+     *
+     * @return V* nullptr if the key is missing
+     */
+    V *find(const Shared<K> &key)
+    {
+      auto it = m_entries.find(key.owner());
+      return it == m_entries.end() ? nullptr : &it->second.value;
+    }
+
+    /**
+     * @brief Remove a key
+     *
+     * @return bool true if it was in the map
+     */
+    bool erase(const Shared<K> &key)
+    {
+      return m_entries.erase(key.owner()) != 0;
+    }
+
+    /**
+     * @brief Get the number of entries, expired ones included until they are purged
+     *
+     * @return std::size_t
+     */
+    std::size_t size() const
+    {
+      return m_entries.size();
+    }
+
+    /**
+     * @brief Remove every entry whose key expired
+     */
+    void purge()
+    {
+      for (auto it = m_entries.begin(); it != m_entries.end();)
+      {
+        it = it->second.key.expired() ? m_entries.erase(it) : std::next(it);
+      }
+      m_purgeAt = std::max(MinPurge, m_entries.size() * 2);
+    }
+
+  private:
+    static constexpr std::size_t MinPurge = 16;
+
+    struct Entry
+    {
+      Weak<K> key;
+      V value;
+    };
+
+    std::unordered_map<const BlockControl *, Entry, detail::BlockHash> m_entries;
+    std::size_t m_purgeAt = MinPurge;
+
+    void maybePurge()
+    {
+      if (m_entries.size() >= m_purgeAt)
+      {
+        purge();
+      }
+    }
+  };
+
+SP_END_NAMESPACE
+
+#endif // SP_WEAKSET_H
@@ -0,0 +1,484 @@
+// Purpose: Benchmark the Unique, Shared, and Weak pointer classes.
+
+// Every benchmark prints one line per configuration, the time is the best of a few runs.
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AtomicWeak.h"
+#include "BulkRelease.h"
+#include "Channel.h"
+#include "Shared.h"
+#include "Striped.h"
+#include "Unique.h"
+#include "Vector.h"
+#include "Weak.h"
+
+namespace
+{
+  constexpr int Runs = 3;
+
+  /**
+   * @brief Run a function on several threads at once and return the best wall time in seconds
+   */
+  double timeThreads(unsigned threads, const std::function<void()> &body)
+  {
+    double best = 1e30;
+    for (int run = 0; run < Runs; ++run)
+    {
+      std::vector<std::thread> workers;
+      auto start = std::chrono::steady_clock::now();
+      for (unsigned t = 0; t < threads; ++t)
+      {
+        workers.emplace_back(body);
+      }
+      for (auto &worker : workers)
+      {
+        worker.join();
+      }
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      best = std::min(best, elapsed.count());
+    }
+    return best;
+  }
+
+  unsigned maxThreads()
+  {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // mark of a run with more threads than cores, its threads take turns instead of contending
+  const char *oversubscribed(unsigned threads)
+  {
+    return threads > maxThreads() ? " (oversubscribed)" : "";
+  }
+
+  /******************************************
+   * Copies of the same hot pointer         *
+   ******************************************/
+
+  template <typename Pointer>
+  void copyHotPointer(const char *name, const Pointer &hot)
+  {
+    constexpr long Copies = 1000000;
+    for (unsigned threads = 1; threads <= maxThreads(); threads *= 2)
+    {
+      double seconds = timeThreads(threads, [&hot]()
+                                   {
+        for (long i = 0; i < Copies; ++i)
+        {
+          Pointer copy = hot;
+          if (!copy)
+          {
+            std::abort();
+          }
+        } });
+      std::printf("%-28s threads=%-3u %8.2f Mcopies/s\n", name, threads, threads * Copies / seconds / 1e6);
+    }
+  }
+
+  void benchHotCopies()
+  {
+    auto shared = sp::Shared<int>::makeShared(1);
+    copyHotPointer("Shared copy", shared);
+    auto striped = sp::StripedShared<int>::makeShared(1);
+    copyHotPointer("StripedShared copy", striped);
+  }
+
+  /******************************************
+   * Pooled allocations against malloc      *
+   ******************************************/
+
+  struct MallocMessage
+  {
+    long id;
+    char payload[56];
+  };
+
+  struct PooledMessage
+  {
+    long id;
+    char payload[56];
+  };
+}
+
+template <>
+struct sp::PoolTraits<PooledMessage> : sp::PoolEnabled
+{
+};
+
+namespace
+{
+  // Handle is Unique or Shared, its control block comes from the pool of the message too
+  template <typename Handle, typename Make>
+  void allocateMessages(const char *name, Make make)
+  {
+    constexpr long Messages = 1000000;
+    constexpr int Batch = 16; // Objects alive at once in each thread
+    for (unsigned threads = 1; threads <= maxThreads(); threads *= 2)
+    {
+      double seconds = timeThreads(threads, [make]()
+                                   {
+        Handle batch[Batch];
+        for (long i = 0; i < Messages; ++i)
+        {
+          batch[i % Batch] = make();
+        } });
+      std::printf("%-28s threads=%-3u %8.2f Mallocs/s\n", name, threads, threads * Messages / seconds / 1e6);
+    }
+  }
+
+  void benchPool()
+  {
+    allocateMessages<sp::Unique<MallocMessage>>("makeUnique malloc", []()
+                                                { return sp::Unique<MallocMessage>::makeUnique(); });
+    allocateMessages<sp::Unique<PooledMessage>>("makeUnique pool", []()
+                                                { return sp::Unique<PooledMessage>::makeUnique(); });
+    allocateMessages<sp::Shared<MallocMessage>>("makeShared malloc", []()
+                                                { return sp::Shared<MallocMessage>::makeShared(); });
+    allocateMessages<sp::Shared<PooledMessage>>("makeShared pool", []()
+                                                { return sp::Shared<PooledMessage>::makeShared(); });
+  }
+
+  /******************************************
+   * Growing vectors of Shared handles      *
+   ******************************************/
+
+  template <typename Vector>
+  void growVector(const char *name)
+  {
+    constexpr long Handles = 4000000;
+    auto shared = sp::Shared<int>::makeShared(1);
+    double seconds = timeThreads(1, [&shared]()
+                                 {
+      Vector vector;
+      for (long i = 0; i < Handles; ++i)
+      {
+        vector.push_back(shared);
+      } });
+    std::printf("%-28s handles=%-8ld %8.2f ms\n", name, Handles, seconds * 1e3);
+  }
+
+  void benchVector()
+  {
+    growVector<std::vector<sp::Shared<int>>>("std::vector<Shared> grow");
+    growVector<sp::Vector<sp::Shared<int>>>("sp::Vector<Shared> grow");
+  }
+
+  /******************************************
+   * Weak back-references read and replaced *
+   ******************************************/
+
+  // a Weak pointer slot guarded by a mutex, what AtomicWeak replaces
+  class MutexWeak
+  {
+  public:
+    explicit MutexWeak(const sp::Weak<int> &weak) : m_weak(weak) {}
+
+    sp::Shared<int> lock()
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      return m_weak.lock();
+    }
+
+    void store(const sp::Weak<int> &weak)
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      m_weak = weak;
+    }
+
+  private:
+    std::mutex m_mutex;
+    sp::Weak<int> m_weak;
+  };
+
+  template <typename Slot>
+  void readWeakSlot(const char *name)
+  {
+    constexpr long Operations = 1000000;
+    constexpr long StoreEvery = 16; // One store for 15 locks
+    auto first = sp::Shared<int>::makeShared(1);
+    auto second = sp::Shared<int>::makeShared(2);
+    Slot slot{sp::Weak<int>(first)};
+    // up to 4 threads even on fewer cores, to exercise the concurrent paths, but only the runs that
+    // are not oversubscribed measure contention
+    for (unsigned threads = 1; threads <= std::max(4u, maxThreads()); threads *= 2)
+    {
+      double seconds = timeThreads(threads, [&]()
+                                   {
+        for (long i = 0; i < Operations; ++i)
+        {
+          if (i % StoreEvery == 0)
+          {
+            slot.store(sp::Weak<int>(i % (2 * StoreEvery) ? first : second));
+          }
+          else if (!slot.lock())
+          {
+            std::abort();
+          }
+        } });
+      std::printf("%-28s threads=%-3u %8.2f Mops/s%s\n", name, threads, threads * Operations / seconds / 1e6, oversubscribed(threads));
+    }
+  }
+
+  void benchAtomicWeak()
+  {
+    readWeakSlot<MutexWeak>("mutex Weak lock/store");
+    readWeakSlot<sp::AtomicWeak<int>>("AtomicWeak lock/store");
+  }
+
+  /******************************************
+   * Teardown of large vectors of Shared    *
+   ******************************************/
+
+  // a counted object, shuffled so that consecutive handles point to distant blocks
+  struct Payload
+  {
+    long value[4];
+  };
+
+  std::vector<sp::Shared<Payload>> scatteredHandles(long count)
+  {
+    std::vector<sp::Shared<Payload>> handles;
+    handles.reserve(count);
+    for (long i = 0; i < count; ++i)
+    {
+      handles.push_back(sp::Shared<Payload>::makeShared());
+    }
+    std::shuffle(handles.begin(), handles.end(), std::mt19937(42));
+    return handles;
+  }
+
+  void tearDown(const char *name, const std::function<void(std::vector<sp::Shared<Payload>> &)> &release)
+  {
+    constexpr long Handles = 2000000;
+    double best = 1e30;
+    for (int run = 0; run < Runs; ++run)
+    {
+      std::vector<sp::Shared<Payload>> handles = scatteredHandles(Handles);
+      auto start = std::chrono::steady_clock::now();
+      release(handles);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      best = std::min(best, elapsed.count());
+      sp::drainReleases();
+    }
+    std::printf("%-28s handles=%-8ld %8.2f ms\n", name, Handles, best * 1e3);
+  }
+
+  void benchTeardown()
+  {
+    tearDown("one by one", [](std::vector<sp::Shared<Payload>> &handles)
+             { handles.clear(); });
+    tearDown("releaseAll inline", [](std::vector<sp::Shared<Payload>> &handles)
+             { sp::releaseAll(handles); });
+    tearDown("releaseAll background", [](std::vector<sp::Shared<Payload>> &handles)
+             { sp::releaseAll(handles, sp::Teardown::Background); });
+  }
+
+  /******************************************
+   * Work items handed between threads      *
+   ******************************************/
+
+  struct WorkItem
+  {
+    long id;
+  };
+
+  // the bounded mutex-guarded deque Channel replaces
+  class DequeQueue
+  {
+  public:
+    explicit DequeQueue(std::size_t capacity) : m_capacity(capacity) {}
+
+    void push(sp::Unique<WorkItem> &&item)
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_notFull.wait(lock, [this]()
+                     { return m_items.size() < m_capacity; });
+      m_items.push_back(std::move(item));
+      m_notEmpty.notify_one();
+    }
+
+    sp::Unique<WorkItem> pop()
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_notEmpty.wait(lock, [this]()
+                      { return !m_items.empty() || m_closed; });
+      if (m_items.empty())
+      {
+        return sp::Unique<WorkItem>();
+      }
+      sp::Unique<WorkItem> item = std::move(m_items.front());
+      m_items.pop_front();
+      m_notFull.notify_one();
+      return item;
+    }
+
+    std::size_t pushBatch(sp::Unique<WorkItem> *items, std::size_t count)
+    {
+      std::size_t pushed = 0;
+      while (pushed < count)
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this]()
+                       { return m_items.size() < m_capacity; });
+        for (; pushed < count && m_items.size() < m_capacity; ++pushed)
+        {
+          m_items.push_back(std::move(items[pushed]));
+        }
+        m_notEmpty.notify_all();
+      }
+      return pushed;
+    }
+
+    std::size_t popBatch(sp::Unique<WorkItem> *items, std::size_t count)
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_notEmpty.wait(lock, [this]()
+                      { return !m_items.empty() || m_closed; });
+      std::size_t popped = 0;
+      for (; popped < count && !m_items.empty(); ++popped)
+      {
+        items[popped] = std::move(m_items.front());
+        m_items.pop_front();
+      }
+      m_notFull.notify_all();
+      return popped;
+    }
+
+    void close()
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+      m_notEmpty.notify_all();
+    }
+
+  private:
+    std::size_t m_capacity;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<sp::Unique<WorkItem>> m_items;
+    bool m_closed = false;
+  };
+
+  // producers each push their own slice of the items, by batches of the given size, consumers pop until the queue is closed
+  template <typename Queue>
+  void transferItems(const char *name, unsigned producers, unsigned consumers, std::size_t batch)
+  {
+    constexpr long Items = 1000000;
+    constexpr std::size_t Capacity = 1024;
+    // the items are built beforehand, only the transfer is timed
+    std::vector<sp::Unique<WorkItem>> items(Items);
+    for (long i = 0; i < Items; ++i)
+    {
+      items[i] = sp::Unique<WorkItem>::makeUnique(WorkItem{i});
+    }
+    Queue queue(Capacity);
+    std::atomic<long> received(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pushers;
+    std::vector<std::thread> poppers;
+    for (unsigned t = 0; t < producers; ++t)
+    {
+      pushers.emplace_back([&, t]()
+                           {
+        long end = Items * (t + 1) / producers;
+        for (long i = Items * t / producers; i < end; i += batch)
+        {
+          std::size_t count = std::min<long>(batch, end - i);
+          if (batch == 1)
+          {
+            queue.push(std::move(items[i]));
+          }
+          else if (queue.pushBatch(&items[i], count) != count)
+          {
+            std::abort();
+          }
+        } });
+    }
+    for (unsigned t = 0; t < consumers; ++t)
+    {
+      poppers.emplace_back([&]()
+                           {
+        long count = 0;
+        if (batch == 1)
+        {
+          while (sp::Unique<WorkItem> item = queue.pop())
+          {
+            ++count;
+          }
+        }
+        else
+        {
+          std::vector<sp::Unique<WorkItem>> popped(batch);
+          while (std::size_t done = queue.popBatch(popped.data(), batch))
+          {
+            count += done;
+            for (std::size_t i = 0; i < done; ++i)
+            {
+              popped[i].reset();
+            }
+          }
+        }
+        received += count; });
+    }
+    for (std::thread &pusher : pushers)
+    {
+      pusher.join();
+    }
+    queue.close();
+    for (std::thread &popper : poppers)
+    {
+      popper.join();
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    if (received != Items)
+    {
+      std::abort();
+    }
+    std::printf("%-28s %ux%-4u batch=%-4zu %8.2f Mitems/s%s\n", name, producers, consumers, batch,
+                Items / seconds.count() / 1e6, oversubscribed(producers + consumers));
+  }
+
+  // one and many producers against one and many consumers, item by item and by batches
+  template <typename Queue>
+  void transferShapes(const char *name)
+  {
+    const unsigned many = std::max(2u, maxThreads() / 2);
+    const std::pair<unsigned, unsigned> shapes[] = {{1, 1}, {1, many}, {many, 1}, {many, many}};
+    for (std::size_t batch : {std::size_t(1), std::size_t(32)})
+    {
+      for (const auto &shape : shapes)
+      {
+        transferItems<Queue>(name, shape.first, shape.second, batch);
+      }
+    }
+  }
+
+  void benchChannel()
+  {
+    transferShapes<DequeQueue>("mutex deque");
+    transferShapes<sp::Channel<sp::Unique<WorkItem>>>("Channel");
+  }
+}
+
+int main()
+{
+  benchHotCopies();
+  benchPool();
+  benchVector();
+  benchAtomicWeak();
+  benchTeardown();
+  benchChannel();
+  return 0;
+}
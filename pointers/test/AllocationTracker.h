@@ -0,0 +1,173 @@
+#ifndef SP_ALLOCATION_TRACKER_H
+#define SP_ALLOCATION_TRACKER_H
+
+/**
+ * Test-side tracker of heap allocations.
+ *
+ * This header replaces the global operator new and delete, it must be included by a single
+ * translation unit of a test executable and never by the library headers. That executable is
+ * built without sanitizers, whose own allocator checks the replacement would bypass. Allocations are
+ * counted per thread, and only while an AllocationScope is open on that thread, so the tracker
+ * costs nothing to the other tests and to the threads they start.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace sp
+{
+  namespace test
+  {
+
+    // counts of the allocations made on one thread while a scope is open
+    struct AllocationCounts
+    {
+      std::size_t allocations = 0;
+      std::size_t deallocations = 0;
+      std::size_t bytes = 0;
+    };
+
+    namespace detail
+    {
+      // counts of the innermost open scope on this thread, nullptr when none is open
+      inline thread_local AllocationCounts *currentCounts = nullptr;
+
+      inline void *allocate(std::size_t size, std::size_t align = 0) noexcept
+      {
+        if (size == 0)
+        {
+          size = 1;
+        }
+        void *memory;
+        if (align > alignof(std::max_align_t))
+        {
+          // aligned_alloc wants a size multiple of the alignment
+          memory = std::aligned_alloc(align, (size + align - 1) / align * align);
+        }
+        else
+        {
+          memory = std::malloc(size);
+        }
+        if (memory && currentCounts)
+        {
+          ++currentCounts->allocations;
+          currentCounts->bytes += size;
+        }
+        return memory;
+      }
+
+      inline void deallocate(void *memory) noexcept
+      {
+        if (memory && currentCounts)
+        {
+          ++currentCounts->deallocations;
+        }
+        std::free(memory);
+      }
+
+      inline void *allocateOrThrow(std::size_t size, std::size_t align = 0)
+      {
+        void *memory = allocate(size, align);
+        if (!memory)
+        {
+          throw std::bad_alloc();
+        }
+        return memory;
+      }
+    } // namespace detail
+
+    /**
+     * @brief Counts the allocations of the current thread while it is alive
+     *
+     * Scopes nest, an inner scope hides its allocations from the outer one.
+     */
+    class AllocationScope
+    {
+    public:
+      AllocationScope() : m_previous(detail::currentCounts)
+      {
+        detail::currentCounts = &m_counts;
+      }
+
+      ~AllocationScope()
+      {
+        detail::currentCounts = m_previous;
+      }
+
+      AllocationScope(const AllocationScope &) = delete;
+      AllocationScope &operator=(const AllocationScope &) = delete;
+
+      std::size_t allocations() const
+      {
+        return m_counts.allocations;
+      }
+
+      std::size_t deallocations() const
+      {
+        return m_counts.deallocations;
+      }
+
+      std::size_t bytes() const
+      {
+        return m_counts.bytes;
+      }
+
+    private:
+      AllocationCounts m_counts;
+      AllocationCounts *m_previous;
+    };
+
+  } // namespace test
+} // namespace sp
+
+// Replacements of every global allocation function, so none of them reaches a mismatched default
+void *operator new(std::size_t size) { return sp::test::detail::allocateOrThrow(size); }
+void *operator new[](std::size_t size) { return sp::test::detail::allocateOrThrow(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return sp::test::detail::allocate(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return sp::test::detail::allocate(size); }
+void *operator new(std::size_t size, std::align_val_t align) { return sp::test::detail::allocateOrThrow(size, static_cast<std::size_t>(align)); }
+void *operator new[](std::size_t size, std::align_val_t align) { return sp::test::detail::allocateOrThrow(size, static_cast<std::size_t>(align)); }
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return sp::test::detail::allocate(size, static_cast<std::size_t>(align)); }
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return sp::test::detail::allocate(size, static_cast<std::size_t>(align)); }
+
+void operator delete(void *memory) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete[](void *memory) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete(void *memory, std::size_t) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete[](void *memory, std::size_t) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete(void *memory, const std::nothrow_t &) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete[](void *memory, const std::nothrow_t &) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete[](void *memory, std::align_val_t) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete[](void *memory, std::size_t, std::align_val_t) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete(void *memory, std::align_val_t, const std::nothrow_t &) noexcept { sp::test::detail::deallocate(memory); }
+void operator delete[](void *memory, std::align_val_t, const std::nothrow_t &) noexcept { sp::test::detail::deallocate(memory); }
+
+/**
+ * @brief Expect a statement to allocate exactly the given number of times on this thread
+ */
+#define EXPECT_ALLOCATIONS(count, statement)                                   \
+  do                                                                           \
+  {                                                                            \
+    ::sp::test::AllocationScope allocationScope_;                              \
+    statement;                                                                 \
+    EXPECT_EQ(allocationScope_.allocations(), static_cast<std::size_t>(count)) \
+        << "while running: " #statement;                                       \
+  } while (0)
+
+/**
+ * @brief Expect a statement to neither allocate nor free on this thread
+ */
+#define EXPECT_NO_ALLOCATION(statement)                                   \
+  do                                                                      \
+  {                                                                       \
+    ::sp::test::AllocationScope allocationScope_;                         \
+    statement;                                                            \
+    EXPECT_EQ(allocationScope_.allocations(), 0u)                         \
+        << "while running: " #statement;                                  \
+    EXPECT_EQ(allocationScope_.deallocations(), 0u)                       \
+        << "while running: " #statement;                                  \
+  } while (0)
+
+#endif // SP_ALLOCATION_TRACKER_H
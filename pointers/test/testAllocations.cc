@@ -0,0 +1,153 @@
+// Purpose: Test the allocation budgets of the pointer classes.
+
+// Built apart from testPointers, without sanitizers: the tracker replaces the global operator new
+// and delete, which would hide the allocation checks of AddressSanitizer.
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <thread>
+#include <utility>
+
+#include "Shared.h"
+#include "Weak.h"
+#include "Unique.h"
+#include "Cow.h"
+#include "Arena.h"
+#include "BulkRelease.h"
+#include "Future.h"
+#include "Channel.h"
+
+#include "AllocationTracker.h"
+
+/******************************************
+ * Test the allocation budgets            *
+ ******************************************/
+
+namespace
+{
+  // too large for the fused layout, makeShared allocates the object and its block apart
+  struct Large
+  {
+    char data[SP_SHARED_FUSED_THRESHOLD + 1];
+  };
+}
+
+TEST(AllocationTest, ScopeCountsOnlyItsThread)
+{
+  sp::test::AllocationScope scope;
+  std::thread other([]()
+                    { delete new int(1); });
+  std::size_t before = scope.allocations();
+  other.join();
+  EXPECT_ALLOCATIONS(1, delete new int(2));
+  EXPECT_EQ(scope.allocations(), before); // Inner scopes hide their allocations
+}
+
+TEST(AllocationTest, UniqueBudget)
+{
+  sp::Unique<int> unique;
+  EXPECT_ALLOCATIONS(1, unique = sp::Unique<int>::makeUnique(1));
+  sp::Unique<int> moved;
+  EXPECT_NO_ALLOCATION(moved = std::move(unique));
+  EXPECT_NO_ALLOCATION(sp::Unique<int> other(std::move(moved)));
+}
+
+TEST(AllocationTest, MakeSharedBudget)
+{
+  sp::Shared<int> shared;
+  EXPECT_ALLOCATIONS(1, shared = sp::Shared<int>::makeShared(1)); // Object fused with its block
+  sp::Shared<Large> large;
+  EXPECT_ALLOCATIONS(2, large = sp::Shared<Large>::makeShared());
+  int *raw = new int(2);
+  sp::Shared<int> adopted;
+  EXPECT_ALLOCATIONS(1, adopted = sp::Shared<int>(raw)); // Only the block, the object was already allocated
+  EXPECT_NO_ALLOCATION(sp::Shared<int> empty);
+}
+
+TEST(AllocationTest, SharedCopiesAndMovesBudget)
+{
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(1);
+  sp::Shared<int> copy;
+  EXPECT_NO_ALLOCATION(copy = shared);
+  EXPECT_NO_ALLOCATION(sp::Shared<int> constructed(shared));
+  sp::Shared<int> moved;
+  EXPECT_NO_ALLOCATION(moved = std::move(copy));
+  EXPECT_NO_ALLOCATION(sp::Shared<int> constructed(std::move(moved)));
+  EXPECT_NO_ALLOCATION(shared.ownerHash());
+}
+
+TEST(AllocationTest, WeakBudget)
+{
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(1);
+  sp::Weak<int> weak;
+  EXPECT_NO_ALLOCATION(weak = sp::Weak<int>(shared));
+  sp::Weak<int> copy;
+  EXPECT_NO_ALLOCATION(copy = weak);
+  EXPECT_NO_ALLOCATION(sp::Weak<int> moved(std::move(copy)));
+  EXPECT_NO_ALLOCATION(EXPECT_TRUE(weak.lock()));
+}
+
+TEST(AllocationTest, ReleaseBudget)
+{
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(1);
+  sp::Weak<int> weak(shared);
+  sp::test::AllocationScope scope;
+  shared = nullptr; // The block stays for the Weak pointer
+  EXPECT_EQ(scope.deallocations(), 0u);
+  weak = sp::Weak<int>();
+  EXPECT_EQ(scope.deallocations(), 1u);
+  EXPECT_EQ(scope.allocations(), 0u);
+}
+
+TEST(AllocationTest, CowBudget)
+{
+  sp::Cow<int> cow = sp::Cow<int>::makeCow(1);
+  sp::Cow<int> copy;
+  EXPECT_NO_ALLOCATION(copy = cow);
+  EXPECT_ALLOCATIONS(1, copy.mut() = 2); // The first write clones
+  EXPECT_NO_ALLOCATION(copy.mut() = 3);  // Later writes are in place
+}
+
+TEST(AllocationTest, ArenaBudget)
+{
+  sp::Arena arena;
+  EXPECT_ALLOCATIONS(1, arena.makeUnique<int>(1)); // The first chunk
+  EXPECT_NO_ALLOCATION(arena.makeUnique<int>(2));
+  arena.reset();
+  EXPECT_NO_ALLOCATION(arena.makeUnique<int>(3)); // The first chunk is kept
+}
+
+TEST(AllocationTest, ReleaseAllBudget)
+{
+  std::vector<sp::Shared<int>> shareds;
+  sp::SharedVector<int> vector;
+  for (int i = 0; i < 1000; ++i)
+  {
+    shareds.push_back(sp::Shared<int>::makeShared(i)); // Enough dead blocks for several batches
+    vector.push_back(sp::Shared<int>::makeShared(i));
+  }
+  EXPECT_ALLOCATIONS(0, sp::releaseAll(shareds));
+  EXPECT_ALLOCATIONS(0, vector = sp::SharedVector<int>());
+}
+
+TEST(FutureTest, SingleAllocation)
+{
+  sp::Promise<int> promise;
+  EXPECT_ALLOCATIONS(1, sp::Promise<int> other);
+  sp::Future<int> future;
+  EXPECT_NO_ALLOCATION(future = promise.getFuture());
+  EXPECT_NO_ALLOCATION(promise.setValue(3));
+  EXPECT_TRUE(future.ready());
+  EXPECT_EQ(future.get(), 3);
+}
+
+TEST(ChannelTest, NoAllocationOnTransfer)
+{
+  sp::Channel<sp::Unique<int>> channel(8);
+  sp::Unique<int> item = sp::Unique<int>::makeUnique(1);
+  sp::Unique<int> popped;
+  EXPECT_NO_ALLOCATION(channel.push(std::move(item)));
+  EXPECT_NO_ALLOCATION(popped = channel.pop());
+  EXPECT_EQ(*popped, 1);
+}
@@ -0,0 +1,349 @@
+// Purpose: Test the contention profiler and the retention tracker.
+
+// Built apart from testPointers: their hooks are compiled into Shared.h only when the macros below
+// are defined before its first include, testPointers keeps testing the plain configuration.
+#define SP_PROFILE_CONTENTION // Compile the count hooks in, sampling stays off outside the profiler tests
+#define SP_TRACK_RETENTION    // Compile the lifetime hooks in, tracking stays off outside the retention tests
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Shared.h"
+#include "Weak.h"
+#include "BulkRelease.h"
+#include "Contention.h"
+#include "Retention.h"
+
+/******************************************
+ * Test the contention profiler           *
+ ******************************************/
+
+TEST(ContentionTest, OffByDefault)
+{
+  sp::ContentionProfiler::clear();
+  EXPECT_FALSE(sp::ContentionProfiler::running());
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(1);
+  sp::Shared<int> copy(shared);
+  EXPECT_TRUE(sp::ContentionProfiler::top().empty());
+}
+
+TEST(ContentionTest, HottestBlockAndItsThreads)
+{
+  sp::ContentionProfiler::clear();
+  sp::Shared<int> hot = sp::Shared<int>::makeShared(1);
+  sp::Shared<std::string> cold = sp::Shared<std::string>::makeShared("cold");
+  sp::ContentionProfiler::start(1);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+  {
+    threads.emplace_back([&hot]()
+                         {
+      for (int i = 0; i < 1000; ++i)
+      {
+        sp::Shared<int> copy(hot);
+      } });
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+  sp::Shared<std::string> copy(cold);
+  sp::ContentionProfiler::stop();
+
+  std::vector<sp::HotBlock> top = sp::ContentionProfiler::top(2);
+  ASSERT_EQ(top.size(), 2u);
+  EXPECT_EQ(top[0].block, static_cast<const void *>(hot.owner()));
+  EXPECT_EQ(top[0].type, "int");
+  EXPECT_EQ(top[0].samples, 8000u); // A copy and a release per iteration
+  EXPECT_EQ(top[0].threads, 4u);
+  EXPECT_FALSE(top[0].sites.empty());
+  EXPECT_EQ(top[1].block, static_cast<const void *>(cold.owner()));
+  EXPECT_EQ(top[1].threads, 1u);
+  sp::ContentionProfiler::clear();
+}
+
+TEST(ContentionTest, SamplingPeriod)
+{
+  sp::ContentionProfiler::clear();
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(1);
+  sp::ContentionProfiler::start(100);
+  std::thread([&shared]()
+              {
+    for (int i = 0; i < 500; ++i)
+    {
+      sp::Shared<int> copy(shared);
+    } })
+      .join();
+  sp::ContentionProfiler::stop();
+  std::vector<sp::HotBlock> top = sp::ContentionProfiler::top(1);
+  ASSERT_EQ(top.size(), 1u);
+  EXPECT_EQ(top[0].samples, 10u); // 1000 updates, one in 100 sampled
+  sp::ContentionProfiler::clear();
+}
+
+namespace
+{
+  // two call sites of the copy and release of a pointer, not inlined so that each keeps its own addresses
+  [[gnu::noinline]] void copyHundredTimes(const sp::Shared<int> &shared)
+  {
+    for (int i = 0; i < 100; ++i)
+    {
+      sp::Shared<int> copy(shared);
+    }
+  }
+
+  [[gnu::noinline]] void copyThirtyTimes(const sp::Shared<int> &shared)
+  {
+    for (int i = 0; i < 30; ++i)
+    {
+      sp::Shared<int> copy(shared);
+    }
+  }
+}
+
+TEST(ContentionTest, DistinctCallSites)
+{
+  sp::ContentionProfiler::clear();
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(1);
+  sp::ContentionProfiler::start(1);
+  copyHundredTimes(shared);
+  copyThirtyTimes(shared);
+  sp::ContentionProfiler::stop();
+  std::vector<sp::HotBlock> top = sp::ContentionProfiler::top(1);
+  ASSERT_EQ(top.size(), 1u);
+  std::multiset<std::uint64_t> samples;
+  for (const auto &site : top[0].sites)
+  {
+    samples.insert(site.second);
+  }
+  // a copy and a release site in each function
+  EXPECT_EQ(samples, (std::multiset<std::uint64_t>{30, 30, 100, 100}));
+  sp::ContentionProfiler::clear();
+}
+
+TEST(ContentionTest, ReleaseAllIsSampled)
+{
+  sp::ContentionProfiler::clear();
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(1);
+  std::vector<sp::Shared<int>> shareds(10, shared);
+  sp::ContentionProfiler::start(1);
+  sp::releaseAll(shareds);
+  sp::ContentionProfiler::stop();
+  std::vector<sp::HotBlock> top = sp::ContentionProfiler::top(1);
+  ASSERT_EQ(top.size(), 1u);
+  EXPECT_EQ(top[0].samples, 10u); // One per pointer, as single releases
+  EXPECT_EQ(top[0].sites.size(), 1u);
+  sp::ContentionProfiler::clear();
+}
+
+TEST(ContentionTest, DumpToFileAndOnSignal)
+{
+  sp::ContentionProfiler::clear();
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(1);
+  sp::ContentionProfiler::start(1);
+  {
+    sp::Shared<int> copy(shared);
+  }
+  sp::ContentionProfiler::stop();
+
+  std::string path = "/tmp/sp_contention_" + std::to_string(getpid());
+  ASSERT_TRUE(sp::ContentionProfiler::dump(path));
+  std::stringstream content;
+  content << std::ifstream(path).rdbuf();
+  EXPECT_NE(content.str().find("2 1 "), std::string::npos); // Two samples from one thread
+  EXPECT_NE(content.str().find(" int\n"), std::string::npos);
+  std::remove(path.c_str());
+
+  std::string signalPath = path + "_signal";
+  struct sigaction before = {};
+  sigaction(SIGUSR1, nullptr, &before);
+  ASSERT_TRUE(sp::ContentionProfiler::dumpOnSignal(SIGUSR1, signalPath));
+  EXPECT_FALSE(sp::ContentionProfiler::dumpOnSignal(SIGUSR1, signalPath)); // Already installed
+  std::raise(SIGUSR1);
+  bool dumped = false;
+  for (int i = 0; i < 200 && !dumped; ++i)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::ifstream file(signalPath);
+    std::string line;
+    dumped = std::getline(file, line) && std::getline(file, line) && line.find(" int") != std::string::npos;
+  }
+  EXPECT_TRUE(dumped);
+  EXPECT_TRUE(sp::ContentionProfiler::stopDumpOnSignal());
+  EXPECT_FALSE(sp::ContentionProfiler::stopDumpOnSignal());
+  struct sigaction after = {};
+  sigaction(SIGUSR1, nullptr, &after);
+  EXPECT_EQ(after.sa_handler, before.sa_handler); // The previous handler is back
+  std::remove(signalPath.c_str());
+  sp::ContentionProfiler::clear();
+}
+
+/******************************************
+ * Test the retention tracker             *
+ ******************************************/
+
+struct RetentionLarge
+{
+  char data[4096]; // Above the fused threshold, allocated apart from its block
+};
+
+struct RetentionSmall
+{
+  int value;
+};
+
+class RetentionTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    sp::RetentionTracker::start();
+  }
+
+  void TearDown() override
+  {
+    sp::RetentionTracker::stop();
+  }
+
+  // the entry of a block in a query result, or nullptr
+  static const sp::RetainedBlock *find(const std::vector<sp::RetainedBlock> &blocks, const sp::BlockControl *block)
+  {
+    for (const sp::RetainedBlock &retained : blocks)
+    {
+      if (retained.block == block)
+      {
+        return &retained;
+      }
+    }
+    return nullptr;
+  }
+};
+
+TEST_F(RetentionTest, TracksLiveBlocks)
+{
+  sp::Shared<RetentionLarge> large(new RetentionLarge());
+  sp::Shared<RetentionSmall> small = sp::Shared<RetentionSmall>::makeShared();
+  std::vector<sp::RetainedBlock> blocks = sp::RetentionTracker::largest();
+  const sp::RetainedBlock *largeEntry = find(blocks, large.owner());
+  const sp::RetainedBlock *smallEntry = find(blocks, small.owner());
+  ASSERT_NE(largeEntry, nullptr);
+  ASSERT_NE(smallEntry, nullptr);
+  EXPECT_NE(largeEntry->type.find("RetentionLarge"), std::string::npos);
+  EXPECT_GE(largeEntry->bytes, sizeof(RetentionLarge));
+  EXPECT_GE(smallEntry->bytes, sizeof(RetentionSmall));
+  EXPECT_LT(largeEntry - blocks.data(), smallEntry - blocks.data()); // Largest first
+  EXPECT_FALSE(largeEntry->weakOnly);
+  EXPECT_NE(largeEntry->site, nullptr);
+
+  const sp::BlockControl *block = large.owner();
+  large.reset();
+  EXPECT_EQ(find(sp::RetentionTracker::largest(), block), nullptr);
+}
+
+TEST_F(RetentionTest, OldestFirst)
+{
+  sp::Shared<RetentionSmall> first = sp::Shared<RetentionSmall>::makeShared();
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  sp::Shared<RetentionSmall> second = sp::Shared<RetentionSmall>::makeShared();
+  std::vector<sp::RetainedBlock> blocks = sp::RetentionTracker::oldest();
+  const sp::RetainedBlock *firstEntry = find(blocks, first.owner());
+  const sp::RetainedBlock *secondEntry = find(blocks, second.owner());
+  ASSERT_NE(firstEntry, nullptr);
+  ASSERT_NE(secondEntry, nullptr);
+  EXPECT_LT(firstEntry - blocks.data(), secondEntry - blocks.data());
+  EXPECT_GT(firstEntry->age, secondEntry->age);
+}
+
+TEST_F(RetentionTest, WeakOnlyBlocks)
+{
+  sp::Shared<RetentionLarge> shared(new RetentionLarge());
+  sp::Weak<RetentionLarge> weak(shared);
+  const sp::BlockControl *block = shared.owner();
+  EXPECT_EQ(find(sp::RetentionTracker::weakOnly(), block), nullptr);
+
+  shared.reset(); // The object is gone, the Weak pointer keeps the block
+  std::vector<sp::RetainedBlock> weakOnly = sp::RetentionTracker::weakOnly();
+  const sp::RetainedBlock *entry = find(weakOnly, block);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_TRUE(entry->weakOnly);
+  EXPECT_LT(entry->bytes, sizeof(RetentionLarge)); // Only the block is left
+
+  weak.reset();
+  EXPECT_EQ(find(sp::RetentionTracker::largest(), block), nullptr);
+}
+
+namespace
+{
+  // two creation sites, not inlined so that each keeps its own return address
+  [[gnu::noinline]] sp::Shared<RetentionSmall> makeFromFirstSite()
+  {
+    return sp::Shared<RetentionSmall>::makeShared();
+  }
+
+  [[gnu::noinline]] sp::Shared<RetentionSmall> makeFromSecondSite()
+  {
+    return sp::Shared<RetentionSmall>(new RetentionSmall());
+  }
+}
+
+TEST_F(RetentionTest, DistinctCreationSites)
+{
+  sp::Shared<RetentionSmall> first = makeFromFirstSite();
+  sp::Shared<RetentionSmall> second = makeFromSecondSite();
+  sp::Shared<RetentionSmall> again = makeFromFirstSite();
+  std::vector<sp::RetainedBlock> blocks = sp::RetentionTracker::largest(1000);
+  const sp::RetainedBlock *firstEntry = find(blocks, first.owner());
+  const sp::RetainedBlock *secondEntry = find(blocks, second.owner());
+  const sp::RetainedBlock *againEntry = find(blocks, again.owner());
+  ASSERT_NE(firstEntry, nullptr);
+  ASSERT_NE(secondEntry, nullptr);
+  ASSERT_NE(againEntry, nullptr);
+  EXPECT_NE(firstEntry->site, secondEntry->site);
+  EXPECT_EQ(firstEntry->site, againEntry->site);
+}
+
+TEST_F(RetentionTest, SampledStacks)
+{
+  sp::RetentionTracker::start(1); // Every creation
+  sp::Shared<RetentionSmall> shared = sp::Shared<RetentionSmall>::makeShared();
+  std::vector<sp::RetainedBlock> blocks = sp::RetentionTracker::largest(1000);
+  const sp::RetainedBlock *entry = find(blocks, shared.owner());
+  ASSERT_NE(entry, nullptr);
+  EXPECT_FALSE(entry->stack.empty());
+}
+
+TEST_F(RetentionTest, StopForgetsBlocks)
+{
+  sp::Shared<RetentionSmall> shared = sp::Shared<RetentionSmall>::makeShared();
+  sp::RetentionTracker::stop();
+  EXPECT_FALSE(sp::RetentionTracker::running());
+  EXPECT_TRUE(sp::RetentionTracker::largest().empty());
+  sp::RetentionTracker::start();
+  shared.reset(); // Deleting a block created before start is harmless
+  EXPECT_TRUE(sp::RetentionTracker::largest().empty());
+}
+
+TEST_F(RetentionTest, Dump)
+{
+  sp::Shared<RetentionLarge> large(new RetentionLarge());
+  std::string path = ::testing::TempDir() + "retention.txt";
+  ASSERT_TRUE(sp::RetentionTracker::dump(path));
+  std::ifstream file(path);
+  std::stringstream content;
+  content << file.rdbuf();
+  EXPECT_NE(content.str().find("[largest]"), std::string::npos);
+  EXPECT_NE(content.str().find("[weak-only]"), std::string::npos);
+  EXPECT_NE(content.str().find("RetentionLarge"), std::string::npos);
+}
@@ -10,14 +10,112 @@
 #ifndef TEST_WEAK
 #define TEST_WEAK 1 // Set to 0 to disable Weak tests
 #endif // TEST_WEAK
+#ifndef TEST_COW
+#define TEST_COW 1 // Set to 0 to disable Cow tests
+#endif // TEST_COW
+#ifndef TEST_RCU
+#define TEST_RCU 1 // Set to 0 to disable Rcu tests
+#endif // TEST_RCU
+#ifndef TEST_HAZARD
+#define TEST_HAZARD 1 // Set to 0 to disable Hazard tests
+#endif // TEST_HAZARD
+#ifndef TEST_STRIPED
+#define TEST_STRIPED 1 // Set to 0 to disable StripedShared tests
+#endif // TEST_STRIPED
+#ifndef TEST_DEFERRED
+#define TEST_DEFERRED 1 // Set to 0 to disable DeferredCounts tests
+#endif // TEST_DEFERRED
+#ifndef TEST_ARENA
+#define TEST_ARENA 1 // Set to 0 to disable Arena tests
+#endif // TEST_ARENA
+#ifndef TEST_POOL
+#define TEST_POOL 1 // Set to 0 to disable ObjectPool tests
+#endif // TEST_POOL
+#ifndef TEST_VECTOR
+#define TEST_VECTOR 1 // Set to 0 to disable Vector tests
+#endif // TEST_VECTOR
+#ifndef TEST_LAYOUT
+#define TEST_LAYOUT 1 // Set to 0 to disable SharedLayout tests
+#endif // TEST_LAYOUT
+#ifndef TEST_OWNER
+#define TEST_OWNER 1 // Set to 0 to disable owner-based hashing and WeakSet tests
+#endif // TEST_OWNER
+#ifndef TEST_SEGMENT
+#define TEST_SEGMENT 1 // Set to 0 to disable OffsetPtr and Segment tests
+#endif // TEST_SEGMENT
+#ifndef TEST_IPC
+#define TEST_IPC 1 // Set to 0 to disable IpcShared tests
+#endif // TEST_IPC
+#ifndef TEST_LAZY
+#define TEST_LAZY 1 // Set to 0 to disable Lazy tests
+#endif // TEST_LAZY
+#ifndef TEST_ATOMICWEAK
+#define TEST_ATOMICWEAK 1 // Set to 0 to disable AtomicWeak tests
+#endif // TEST_ATOMICWEAK
+#ifndef TEST_NOWEAK
+#define TEST_NOWEAK 1 // Set to 0 to disable no-weak Shared tests
+#endif // TEST_NOWEAK
+#ifndef TEST_BULK
+#define TEST_BULK 1 // Set to 0 to disable releaseAll and SharedVector tests
+#endif // TEST_BULK
+#ifndef TEST_FUTURE
+#define TEST_FUTURE 1 // Set to 0 to disable Promise and Future tests
+#endif // TEST_FUTURE
+#ifndef TEST_CHANNEL
+#define TEST_CHANNEL 1 // Set to 0 to disable Channel tests
+#endif // TEST_CHANNEL
+
+#ifndef TEST_CHECKED
+#define TEST_CHECKED 1 // Set to 0 to disable checking mode tests, built by testPointersChecked only
+#endif // TEST_CHECKED
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <set>
+#include <unordered_set>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "Shared.h"
 #include "Weak.h"
 #include "Unique.h"
+#include "Cow.h"
+#include "Rcu.h"
+#include "Hazard.h"
+#include "Striped.h"
+#include "Deferred.h"
+#include "Arena.h"
+#include "Pool.h"
+#include "Vector.h"
+#include "WeakSet.h"
+#include "Offset.h"
+#include "IpcShared.h"
+#include "Lazy.h"
+#include "AtomicWeak.h"
+#include "BulkRelease.h"
+#include "Future.h"
+#include "Channel.h"
+
+#include <sys/wait.h>
+
+namespace
+{
+  // counts its live instances, to check when the pointers delete their objects
+  struct Tracked
+  {
+    static std::atomic<int> alive;
+    int value;
+    Tracked(int value) : value(value) { ++alive; }
+    Tracked(const Tracked &other) : value(other.value) { ++alive; }
+    ~Tracked() { --alive; }
+  };
+  std::atomic<int> Tracked::alive(0);
+}
 
 #if TEST_UNIQUE
 /******************************************
@@ -79,6 +177,15 @@ TEST(UniqueTest, ObjectDestruction)
   ASSERT_EQ(ptr.get(), nullptr);
 }
 
+TEST(UniqueTest, Release)
+{
+  sp::Unique<int> unique = sp::Unique<int>::makeUnique(5);
+  int *raw = unique.release();
+  EXPECT_FALSE(unique);
+  sp::Unique<int> adopted(raw);
+  EXPECT_EQ(*adopted, 5);
+}
+
 #endif // TEST_UNIQUE
 
 #if TEST_SHARED
@@ -239,6 +346,2076 @@ TEST(WeakTest, ConvertToSharedAfterExpiry)
 
 #endif // TEST_WEAK
 
+#if TEST_COW
+/******************************************
+ * Test the Cow class                     *
+ ******************************************/
+
+TEST(CowTest, CopiesShareStorage)
+{
+  auto original = sp::Cow<std::string>::makeCow("hello");
+  sp::Cow<std::string> copy = original;
+  EXPECT_EQ(original.count(), 2);
+  EXPECT_EQ(&*original, &*copy); // Both copies read the same storage
+}
+
+TEST(CowTest, MutClonesSharedValue)
+{
+  auto original = sp::Cow<std::string>::makeCow("hello");
+  sp::Cow<std::string> copy = original;
+  copy.mut() += " world";
+  EXPECT_EQ(*original, "hello");
+  EXPECT_EQ(*copy, "hello world");
+  EXPECT_TRUE(original.unique());
+  EXPECT_TRUE(copy.unique());
+}
+
+TEST(CowTest, MutDoesNotCloneUniqueValue)
+{
+  auto cow = sp::Cow<std::string>::makeCow("hello");
+  const std::string *before = &*cow;
+  cow.mut() += "!";
+  EXPECT_EQ(&*cow, before); // No clone when there is a single owner
+  EXPECT_EQ(*cow, "hello!");
+}
+
+TEST(CowTest, StorageIsNotAdoptedFromShared)
+{
+  // a Weak pointer on an adopted Shared could lock() while mut() writes in place
+  EXPECT_FALSE((std::is_constructible_v<sp::Cow<int>, sp::Shared<int>>));
+  EXPECT_FALSE((std::is_convertible_v<sp::Shared<int>, sp::Cow<int>>));
+}
+
+TEST(CowTest, MutOnEmptyThrows)
+{
+  sp::Cow<int> cow;
+  EXPECT_FALSE(cow);
+  EXPECT_THROW(cow.mut(), std::runtime_error);
+}
+
+TEST(CowTest, ConcurrentCopiesAndMutations)
+{
+  auto original = sp::Cow<std::vector<int>>::makeCow(100, 1);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+  {
+    threads.emplace_back([&original, t]()
+                         {
+      for (int i = 0; i < 1000; ++i)
+      {
+        sp::Cow<std::vector<int>> copy = original;
+        copy.mut()[0] = t;
+        EXPECT_EQ(copy->size(), 100u);
+      } });
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+  EXPECT_EQ((*original)[0], 1); // The original was never modified
+  EXPECT_EQ(original.count(), 1);
+}
+
+#endif // TEST_COW
+
+#if TEST_RCU
+/******************************************
+ * Test the Rcu class                     *
+ ******************************************/
+
+TEST(RcuTest, ReadCurrentVersion)
+{
+  sp::Rcu<int> rcu(sp::Shared<int>::makeShared(1));
+  auto guard = rcu.read();
+  EXPECT_EQ(*guard, 1);
+}
+
+TEST(RcuTest, UpdateReclaimsWithoutReaders)
+{
+  sp::Rcu<int> rcu(sp::Shared<int>::makeShared(1));
+  sp::Weak<int> old(rcu.snapshot());
+  rcu.update(sp::Shared<int>::makeShared(2));
+  EXPECT_EQ(rcu.pending(), 0u);
+  EXPECT_TRUE(old.expired()); // No reader could see the old version
+  EXPECT_EQ(*rcu.read(), 2);
+}
+
+TEST(RcuTest, ReaderDelaysReclamation)
+{
+  sp::Rcu<int> rcu(sp::Shared<int>::makeShared(1));
+  sp::Weak<int> old(rcu.snapshot());
+  {
+    auto guard = rcu.read();
+    rcu.update(sp::Shared<int>::makeShared(2));
+    EXPECT_EQ(*guard, 1); // The reader keeps its version
+    EXPECT_FALSE(old.expired());
+    EXPECT_EQ(rcu.pending(), 1u);
+  }
+  rcu.synchronize();
+  EXPECT_TRUE(old.expired());
+  EXPECT_EQ(rcu.pending(), 0u);
+}
+
+TEST(RcuTest, ConcurrentReadersAndWriter)
+{
+  sp::Rcu<std::vector<int>> rcu(sp::Shared<std::vector<int>>::makeShared(64, 0));
+  std::atomic<bool> done(false);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t)
+  {
+    readers.emplace_back([&rcu, &done]()
+                         {
+      while (!done.load())
+      {
+        auto guard = rcu.read();
+        int first = guard->front();
+        for (int value : *guard)
+        {
+          ASSERT_EQ(value, first); // A version is never modified nor freed while read
+        }
+      } });
+  }
+  for (int i = 1; i <= 200; ++i)
+  {
+    rcu.update(sp::Shared<std::vector<int>>::makeShared(64, i));
+  }
+  done.store(true);
+  for (auto &reader : readers)
+  {
+    reader.join();
+  }
+  rcu.synchronize();
+  EXPECT_EQ(rcu.read()->front(), 200);
+}
+
+#endif // TEST_RCU
+
+#if TEST_HAZARD
+/******************************************
+ * Test the HazardGuard class             *
+ ******************************************/
+
+TEST(HazardTest, ProtectAliveObject)
+{
+  sp::Shared<int> shared(new int(5));
+  sp::Weak<int> weak(shared);
+  sp::HazardGuard guard;
+  int *ptr = guard.protect(weak);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(*ptr, 5);
+  EXPECT_EQ(shared.count(), 1); // Protecting does not touch the count
+}
+
+TEST(HazardTest, ProtectExpiredObject)
+{
+  sp::Weak<int> weak;
+  {
+    sp::Shared<int> shared(new int(5));
+    weak = shared;
+  }
+  sp::HazardGuard guard;
+  EXPECT_EQ(guard.protect(weak), nullptr);
+}
+
+TEST(HazardTest, DeletionDeferredWhileProtected)
+{
+  Tracked::alive = 0;
+  sp::Shared<Tracked> shared(new Tracked(7));
+  sp::Weak<Tracked> weak(shared);
+  {
+    sp::HazardGuard guard;
+    Tracked *ptr = guard.protect(weak);
+    ASSERT_NE(ptr, nullptr);
+    shared.reset();
+    EXPECT_TRUE(weak.expired());
+    EXPECT_EQ(Tracked::alive, 1); // Still protected by the guard
+    EXPECT_EQ(ptr->value, 7);
+  }
+  EXPECT_EQ(Tracked::alive, 0); // Deleted when the guard released it
+  EXPECT_EQ(sp::detail::HazardDomain::instance().pending(), 0u);
+}
+
+TEST(HazardTest, OnlyProtectedBlocksAreFlagged)
+{
+  sp::Shared<int> plain(new int(1));
+  sp::Shared<int> protectedShared(new int(2));
+  sp::Weak<int> weak(protectedShared);
+  sp::Weak<int> plainWeak(plain);
+  EXPECT_FALSE(plain.owner()->hazardous());
+  EXPECT_FALSE(protectedShared.owner()->hazardous());
+  {
+    sp::HazardGuard guard;
+    ASSERT_NE(guard.protect(weak), nullptr);
+  }
+  EXPECT_FALSE(plain.owner()->hazardous()); // Releasing it never scans the hazard slots
+  EXPECT_TRUE(protectedShared.owner()->hazardous());
+  EXPECT_EQ(protectedShared.count(), 1); // The flag is not counted
+  EXPECT_FALSE(weak.expired());
+}
+
+TEST(HazardTest, ConcurrentReadersAndRelease)
+{
+  Tracked::alive = 0;
+  for (int round = 0; round < 100; ++round)
+  {
+    sp::Shared<Tracked> shared(new Tracked(round));
+    sp::Weak<Tracked> weak(shared);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t)
+    {
+      readers.emplace_back([&weak, round]()
+                           {
+        for (int i = 0; i < 100; ++i)
+        {
+          sp::HazardGuard guard;
+          if (Tracked *ptr = guard.protect(weak))
+          {
+            ASSERT_EQ(ptr->value, round);
+          }
+        } });
+    }
+    shared.reset();
+    for (auto &reader : readers)
+    {
+      reader.join();
+    }
+  }
+  sp::reclaimHazards();
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+#endif // TEST_HAZARD
+
+#if TEST_STRIPED
+/******************************************
+ * Test the StripedShared class           *
+ ******************************************/
+
+TEST(StripedSharedTest, makeShared)
+{
+  auto striped = sp::StripedShared<int>::makeShared(5);
+  EXPECT_EQ(*striped, 5);
+  EXPECT_EQ(striped.count(), 1);
+}
+
+TEST(StripedSharedTest, CopiesAndReleases)
+{
+  auto striped = sp::StripedShared<int>::makeShared(5);
+  {
+    auto copy1 = striped;
+    auto copy2 = copy1;
+    EXPECT_EQ(striped.count(), 3);
+  }
+  EXPECT_EQ(striped.count(), 1);
+}
+
+TEST(StripedSharedTest, BaseReleasedBeforeCopies)
+{
+  Tracked::alive = 0;
+  auto striped = sp::StripedShared<Tracked>::makeShared(3);
+  auto copy = striped;
+  striped.reset(); // The count switches to a single atomic count
+  EXPECT_EQ(Tracked::alive, 1);
+  EXPECT_EQ(copy.count(), 1);
+  auto other = copy;
+  EXPECT_EQ(copy.count(), 2);
+  copy.reset();
+  EXPECT_EQ(Tracked::alive, 1);
+  other.reset();
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(StripedSharedTest, ConcurrentCopiesWhileBaseReleased)
+{
+  Tracked::alive = 0;
+  for (int round = 0; round < 50; ++round)
+  {
+    auto striped = sp::StripedShared<Tracked>::makeShared(round);
+    std::vector<sp::StripedShared<Tracked>> seeds(4, striped);
+    std::vector<std::thread> threads;
+    for (auto &seed : seeds)
+    {
+      threads.emplace_back([&seed, round]()
+                           {
+        for (int i = 0; i < 200; ++i)
+        {
+          auto copy = seed;
+          ASSERT_EQ(copy->value, round);
+        }
+        seed.reset(); });
+    }
+    striped.reset();
+    for (auto &thread : threads)
+    {
+      thread.join();
+    }
+    EXPECT_EQ(Tracked::alive, 0);
+  }
+}
+
+#endif // TEST_STRIPED
+
+#if TEST_DEFERRED
+/******************************************
+ * Test the DeferredCounts class          *
+ ******************************************/
+
+namespace
+{
+  // types whose counts DeferredCounts batches
+  struct Batched
+  {
+    int value;
+  };
+
+  struct BatchedTracked : Tracked
+  {
+    using Tracked::Tracked;
+  };
+}
+
+template <>
+struct sp::DeferredTraits<Batched> : sp::DeferredEnabled
+{
+};
+
+template <>
+struct sp::DeferredTraits<BatchedTracked> : sp::DeferredEnabled
+{
+};
+
+template <>
+struct sp::DeferredTraits<sp::Shared<BatchedTracked>> : sp::DeferredEnabled
+{
+};
+
+TEST(DeferredTest, CopyAndDropPairsCancel)
+{
+  auto shared = sp::Shared<Batched>::makeShared(Batched{5});
+  sp::DeferredCounts deferred;
+  for (int i = 0; i < 100; ++i)
+  {
+    sp::Shared<Batched> copy = shared;
+    EXPECT_EQ(copy->value, 5);
+  }
+  EXPECT_EQ(shared.count(), 2); // A single decrement is still pending
+  EXPECT_EQ(deferred.pending(), 1u);
+  deferred.flush();
+  EXPECT_EQ(shared.count(), 1);
+  EXPECT_EQ(deferred.pending(), 0u);
+}
+
+TEST(DeferredTest, DeletionWaitsForFlush)
+{
+  Tracked::alive = 0;
+  {
+    sp::DeferredCounts deferred;
+    sp::Shared<BatchedTracked> shared(new BatchedTracked(1));
+    shared.reset();
+    EXPECT_EQ(Tracked::alive, 1); // The decrement is only logged
+    deferred.flush();
+    EXPECT_EQ(Tracked::alive, 0);
+  }
+  {
+    sp::DeferredCounts deferred;
+    sp::Shared<BatchedTracked> shared(new BatchedTracked(2));
+  }
+  EXPECT_EQ(Tracked::alive, 0); // Flushed at the end of the scope
+}
+
+TEST(DeferredTest, FlushWhenFull)
+{
+  Tracked::alive = 0;
+  sp::DeferredCounts deferred;
+  for (std::size_t i = 0; i < sp::detail::RefBuffer::Capacity * 3; ++i)
+  {
+    sp::Shared<BatchedTracked> shared(new BatchedTracked(static_cast<int>(i)));
+  }
+  EXPECT_LE(deferred.pending(), sp::detail::RefBuffer::Capacity);
+  EXPECT_LE(Tracked::alive, static_cast<int>(sp::detail::RefBuffer::Capacity));
+  deferred.flush();
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(DeferredTest, NestedObjectsReleasedByFlush)
+{
+  Tracked::alive = 0;
+  {
+    sp::DeferredCounts deferred;
+    sp::Shared<sp::Shared<BatchedTracked>> outer(new sp::Shared<BatchedTracked>(new BatchedTracked(3)));
+  }
+  EXPECT_EQ(Tracked::alive, 0); // The inner decrement logged during the flush is applied too
+}
+
+TEST(DeferredTest, OtherTypesAreNotBatched)
+{
+  Tracked::alive = 0;
+  sp::DeferredCounts deferred;
+  sp::Shared<Tracked> shared(new Tracked(4));
+  sp::Shared<Tracked> copy = shared;
+  EXPECT_EQ(shared.count(), 2);
+  copy.reset();
+  shared.reset();
+  EXPECT_EQ(Tracked::alive, 0); // Deleted right away, inside the scope
+  EXPECT_EQ(deferred.pending(), 0u);
+}
+
+TEST(DeferredTest, ReleaseAllDefers)
+{
+  auto shared = sp::Shared<Batched>::makeShared(Batched{1});
+  {
+    sp::DeferredCounts deferred;
+    std::vector<sp::Shared<Batched>> shareds(10, shared);
+    sp::releaseAll(shareds);
+    EXPECT_EQ(shared.count(), 11); // The decrements wait in the buffer, as for single releases
+    EXPECT_EQ(deferred.pending(), 1u); // One entry for the block
+  }
+  EXPECT_EQ(shared.count(), 1);
+}
+
+#endif // TEST_DEFERRED
+
+#if TEST_ARENA
+/******************************************
+ * Test the Arena and ArenaUnique classes *
+ ******************************************/
+
+TEST(ArenaTest, makeUnique)
+{
+  sp::Arena arena;
+  auto ptr = arena.makeUnique<int>(5);
+  ASSERT_EQ(*ptr, 5);
+  ASSERT_TRUE(ptr.exists());
+}
+
+TEST(ArenaTest, MoveSemantics)
+{
+  sp::Arena arena;
+  auto ptr1 = arena.makeUnique<std::string>("arena");
+  sp::ArenaUnique<std::string> ptr2 = std::move(ptr1);
+  EXPECT_FALSE(ptr1.exists());
+  EXPECT_EQ(*ptr2, "arena");
+  sp::ArenaUnique<std::string> ptr3;
+  ptr3 = std::move(ptr2);
+  EXPECT_EQ(ptr3->size(), 5u);
+}
+
+TEST(ArenaTest, DestructorRuns)
+{
+  Tracked::alive = 0;
+  sp::Arena arena;
+  {
+    auto ptr = arena.makeUnique<Tracked>(1);
+    EXPECT_EQ(Tracked::alive, 1);
+  }
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(ArenaTest, AlignmentRespected)
+{
+  struct alignas(64) Aligned
+  {
+    char data[3];
+  };
+  sp::Arena arena(256);
+  auto small = arena.makeUnique<char>('a');
+  auto aligned = arena.makeUnique<Aligned>();
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(aligned.get()) % 64, 0u);
+}
+
+TEST(ArenaTest, ResetReleasesChunks)
+{
+  sp::Arena arena(1024);
+  for (int i = 0; i < 1000; ++i)
+  {
+    auto ptr = arena.makeUnique<long>(i);
+  }
+  EXPECT_GT(arena.chunks(), 1u);
+  arena.reset();
+  EXPECT_EQ(arena.chunks(), 1u); // The first chunk is kept for reuse
+  EXPECT_EQ(arena.generation(), 1u);
+  auto ptr = arena.makeUnique<long>(42);
+  EXPECT_EQ(*ptr, 42);
+}
+
+TEST(ArenaTest, ResetAbandonsLiveObjects)
+{
+  Tracked::alive = 0;
+  sp::Arena arena(256);
+  auto first = arena.makeUnique<Tracked>(1);
+  for (int i = 0; i < 32; ++i)
+  {
+    arena.makeUnique<long>(i); // Fill more chunks, released by the reset
+  }
+  auto last = arena.makeUnique<Tracked>(2);
+  arena.reset();
+  first.reset(); // Nothing is run, the memory is gone
+  last.reset();
+  EXPECT_FALSE(last.exists());
+  EXPECT_EQ(Tracked::alive, 2); // Dropped by the reset without their destructors
+  Tracked::alive = 0;
+}
+
+TEST(ArenaTest, SkipDestructors)
+{
+  Tracked::alive = 0;
+  sp::Arena arena(1024, sp::ArenaDestructors::Skip);
+  EXPECT_FALSE(arena.runsDestructors());
+  {
+    auto ptr = arena.makeUnique<Tracked>(1);
+    EXPECT_EQ(ptr->value, 1);
+  }
+  EXPECT_EQ(Tracked::alive, 1); // Left to the arena
+  arena.reset();
+  Tracked::alive = 0;
+}
+
+#ifndef NDEBUG
+TEST(ArenaDeathTest, UseAfterReset)
+{
+  EXPECT_DEATH({
+    sp::Arena arena;
+    auto ptr = arena.makeUnique<int>(5);
+    arena.reset();
+    (void)*ptr;
+  }, "after the reset");
+}
+#endif // NDEBUG
+
+#endif // TEST_ARENA
+
+#if TEST_POOL
+/******************************************
+ * Test the ObjectPool class              *
+ ******************************************/
+
+namespace
+{
+  struct Message
+  {
+    long id;
+    char payload[56];
+  };
+}
+
+template <>
+struct sp::PoolTraits<Message> : sp::PoolEnabled
+{
+  static constexpr std::size_t threadCapacity = 8;
+  static constexpr std::size_t depotCapacity = 16;
+};
+
+TEST(PoolTest, UniqueReusesFreedSlot)
+{
+  sp::ObjectPool<Message>::trim();
+  Message *first;
+  {
+    auto ptr = sp::Unique<Message>::makeUnique(Message{1, {}});
+    first = ptr.get();
+  }
+  EXPECT_EQ(sp::ObjectPool<Message>::cached(), 1u);
+  auto ptr = sp::Unique<Message>::makeUnique(Message{2, {}});
+  EXPECT_EQ(ptr.get(), first); // The freed slot is handed out again
+  EXPECT_EQ(ptr->id, 2);
+  EXPECT_EQ(sp::ObjectPool<Message>::cached(), 0u);
+}
+
+TEST(PoolTest, SharedUsesPool)
+{
+  using Block = sp::InplaceBlock<Message>;
+  sp::ObjectPool<Message>::trim();
+  sp::ObjectPool<Block>::trim();
+  {
+    auto shared = sp::Shared<Message>::makeShared(Message{3, {}});
+    sp::Shared<Message> copy = shared;
+    EXPECT_EQ(copy->id, 3);
+  }
+#ifndef SP_CHECKED // Deleted blocks are quarantined instead
+  EXPECT_EQ(sp::ObjectPool<Block>::cached(), 1u); // The fused block, object included
+#endif
+  EXPECT_EQ(sp::ObjectPool<Message>::cached(), 0u);
+  {
+    sp::Shared<Message> adopted(new Message{4, {}});
+  }
+#ifndef SP_CHECKED
+  EXPECT_EQ(sp::ObjectPool<sp::PointerBlock<Message>>::cached(), 1u); // A separate block is pooled too
+#endif
+  EXPECT_EQ(sp::ObjectPool<Message>::cached(), 1u);
+  sp::ObjectPool<Block>::trim();
+  sp::ObjectPool<sp::PointerBlock<Message>>::trim();
+  sp::ObjectPool<Message>::trim();
+}
+
+TEST(PoolTest, RawNewGoesToPool)
+{
+  sp::ObjectPool<Message>::trim();
+  {
+    sp::Unique<Message> ptr(new Message{4, {}});
+  }
+  EXPECT_EQ(sp::ObjectPool<Message>::cached(), 1u);
+  sp::ObjectPool<Message>::trim();
+  EXPECT_EQ(sp::ObjectPool<Message>::cached(), 0u);
+}
+
+TEST(PoolTest, ThreadCacheIsCapped)
+{
+  sp::ObjectPool<Message>::trim();
+  {
+    std::vector<sp::Unique<Message>> ptrs;
+    for (int i = 0; i < 64; ++i)
+    {
+      ptrs.push_back(sp::Unique<Message>::makeUnique(Message{i, {}}));
+    }
+  }
+  EXPECT_LE(sp::ObjectPool<Message>::cached(), sp::PoolTraits<Message>::threadCapacity);
+  sp::ObjectPool<Message>::trim();
+}
+
+namespace
+{
+  struct Tiny
+  {
+    long value;
+  };
+}
+
+template <>
+struct sp::PoolTraits<Tiny> : sp::PoolEnabled
+{
+  static constexpr std::size_t threadCapacity = 1;
+};
+
+TEST(PoolTest, SmallThreadCapacity)
+{
+  sp::ObjectPool<Tiny>::trim();
+  std::set<void *> freed;
+  {
+    std::vector<sp::Unique<Tiny>> ptrs;
+    for (int i = 0; i < 8; ++i)
+    {
+      ptrs.push_back(sp::Unique<Tiny>::makeUnique(Tiny{i}));
+      freed.insert(ptrs.back().get());
+    }
+  }
+  EXPECT_LE(sp::ObjectPool<Tiny>::cached(), 1u); // Overflow still reaches the depot
+  std::vector<sp::Unique<Tiny>> again;
+  for (int i = 0; i < 4; ++i)
+  {
+    again.push_back(sp::Unique<Tiny>::makeUnique(Tiny{i}));
+    EXPECT_EQ(freed.count(again.back().get()), 1u); // Refilled from the depot, not from malloc
+  }
+  again.clear();
+  sp::ObjectPool<Tiny>::trim();
+}
+
+TEST(PoolTest, FreedOnAnotherThread)
+{
+  sp::ObjectPool<Message>::trim();
+  std::vector<sp::Unique<Message>> ptrs;
+  for (int i = 0; i < 32; ++i)
+  {
+    ptrs.push_back(sp::Unique<Message>::makeUnique(Message{i, {}}));
+  }
+  std::thread consumer([&ptrs]()
+                       { ptrs.clear(); }); // Freed into the cache of the consumer, then to the depot when it exits
+  consumer.join();
+  auto ptr = sp::Unique<Message>::makeUnique(Message{5, {}});
+  EXPECT_GT(sp::ObjectPool<Message>::cached(), 0u); // Refilled from the depot
+  sp::ObjectPool<Message>::trim();
+}
+
+#endif // TEST_POOL
+
+#if TEST_VECTOR
+/******************************************
+ * Test the Vector class                  *
+ ******************************************/
+
+static_assert(sp::is_trivially_relocatable_v<sp::Unique<std::string>>);
+static_assert(sp::is_trivially_relocatable_v<sp::Shared<std::string>>);
+static_assert(sp::is_trivially_relocatable_v<sp::Weak<std::string>>);
+static_assert(sp::is_trivially_relocatable_v<int>);
+static_assert(!sp::is_trivially_relocatable_v<std::string>);
+
+TEST(VectorTest, GrowKeepsCounts)
+{
+  auto shared = sp::Shared<int>::makeShared(5);
+  sp::Vector<sp::Shared<int>> vector;
+  for (int i = 0; i < 1000; ++i)
+  {
+    vector.push_back(shared);
+  }
+  EXPECT_EQ(vector.size(), 1000u);
+  EXPECT_EQ(shared.count(), 1001); // Relocation neither copies nor destroys
+  vector.clear();
+  EXPECT_EQ(shared.count(), 1);
+}
+
+TEST(VectorTest, InsertAndErase)
+{
+  sp::Vector<sp::Unique<int>> vector;
+  for (int i = 0; i < 5; ++i)
+  {
+    vector.push_back(sp::Unique<int>::makeUnique(i));
+  }
+  vector.insert(vector.begin() + 2, sp::Unique<int>::makeUnique(42));
+  ASSERT_EQ(vector.size(), 6u);
+  EXPECT_EQ(*vector[2], 42);
+  EXPECT_EQ(*vector[3], 2);
+  vector.erase(vector.begin() + 1);
+  ASSERT_EQ(vector.size(), 5u);
+  EXPECT_EQ(*vector[0], 0);
+  EXPECT_EQ(*vector[1], 42);
+  EXPECT_EQ(*vector[4], 4);
+}
+
+TEST(VectorTest, NonRelocatableElements)
+{
+  sp::Vector<std::string> vector;
+  for (int i = 0; i < 100; ++i)
+  {
+    vector.push_back(std::to_string(i));
+  }
+  vector.insert(vector.begin(), "first");
+  vector.erase(vector.begin() + 50);
+  EXPECT_EQ(vector[0], "first");
+  EXPECT_EQ(vector[1], "0");
+  EXPECT_EQ(vector[50], "50");
+  EXPECT_EQ(vector.size(), 100u);
+}
+
+TEST(VectorTest, CopyAndMove)
+{
+  Tracked::alive = 0;
+  {
+    sp::Vector<sp::Shared<Tracked>> vector;
+    vector.emplace_back(new Tracked(1));
+    sp::Vector<sp::Shared<Tracked>> copy = vector;
+    EXPECT_EQ(vector[0].count(), 2);
+    sp::Vector<sp::Shared<Tracked>> moved = std::move(vector);
+    EXPECT_TRUE(vector.empty());
+    EXPECT_EQ(moved[0].count(), 2);
+  }
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(VectorTest, PushElementAtFullCapacity)
+{
+  sp::Vector<sp::Shared<int>> shareds;
+  shareds.push_back(sp::Shared<int>::makeShared(7));
+  while (shareds.size() < shareds.capacity())
+  {
+    shareds.push_back(shareds[0]);
+  }
+  shareds.push_back(shareds[0]); // Copied before the buffer is moved by realloc
+  shareds.emplace_back(shareds.back());
+  EXPECT_EQ(*shareds.back(), 7);
+  EXPECT_EQ(shareds[0].count(), shareds.size());
+
+  sp::Vector<std::string> strings;
+  strings.push_back("element");
+  while (strings.size() < strings.capacity())
+  {
+    strings.push_back(strings[0]);
+  }
+  strings.push_back(strings[0]); // Copied before the old buffer is freed
+  EXPECT_EQ(strings.back(), "element");
+}
+
+namespace
+{
+  // copies throw once the countdown reaches zero, moves may throw so growing copies
+  struct FragileCopy
+  {
+    static int alive;
+    static int copiesLeft;
+    FragileCopy() { ++alive; }
+    FragileCopy(const FragileCopy &)
+    {
+      if (copiesLeft-- == 0)
+      {
+        throw std::runtime_error("copy failed");
+      }
+      ++alive;
+    }
+    FragileCopy(FragileCopy &&) noexcept(false) { ++alive; }
+    ~FragileCopy() { --alive; }
+  };
+
+  int FragileCopy::alive = 0;
+  int FragileCopy::copiesLeft = 0;
+}
+
+TEST(VectorTest, FailedGrowthKeepsElements)
+{
+  {
+    sp::Vector<FragileCopy> vector;
+    for (int i = 0; i < 4; ++i)
+    {
+      vector.emplace_back();
+    }
+    FragileCopy::copiesLeft = 2;
+    EXPECT_THROW(vector.reserve(100), std::runtime_error);
+    EXPECT_EQ(vector.size(), 4u);
+    EXPECT_EQ(vector.capacity(), 4u);
+    EXPECT_EQ(FragileCopy::alive, 4); // The copies already built are destroyed
+    FragileCopy::copiesLeft = 1;
+    EXPECT_THROW(vector.emplace_back(), std::runtime_error);
+    EXPECT_EQ(vector.size(), 4u);
+    EXPECT_EQ(FragileCopy::alive, 4);
+  }
+  EXPECT_EQ(FragileCopy::alive, 0); // Each element destroyed once
+}
+
+TEST(VectorTest, CapacityOverflow)
+{
+  sp::Vector<std::string> vector;
+  EXPECT_THROW(vector.reserve(SIZE_MAX / 2), std::length_error);
+  EXPECT_TRUE(vector.empty());
+}
+
+#endif // TEST_VECTOR
+
+#if TEST_LAYOUT
+/******************************************
+ * Test the layout chosen by makeShared   *
+ ******************************************/
+
+namespace
+{
+  struct LargeObject
+  {
+    static std::atomic<int> alive;
+    static std::atomic<std::size_t> allocatedBytes; // Object memory not given back yet
+    char data[64 * 1024];
+    LargeObject() { ++alive; }
+    ~LargeObject() { --alive; }
+
+    static void *operator new(std::size_t size)
+    {
+      allocatedBytes += size;
+      return ::operator new(size);
+    }
+
+    static void operator delete(void *memory, std::size_t size)
+    {
+      allocatedBytes -= size;
+      ::operator delete(memory);
+    }
+  };
+  std::atomic<int> LargeObject::alive(0);
+  std::atomic<std::size_t> LargeObject::allocatedBytes(0);
+}
+
+TEST(SharedLayoutTest, SmallObjectFused)
+{
+  static_assert(sp::SharedLayout<int>::fused);
+  auto shared = sp::Shared<int>::makeShared(5);
+  sp::Weak<int> weak(shared);
+  EXPECT_EQ(*weak.lock(), 5);
+  shared.reset();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(SharedLayoutTest, FusedObjectDestroyedWithWeak)
+{
+  Tracked::alive = 0;
+  auto shared = sp::Shared<Tracked>::makeShared(1);
+  sp::Weak<Tracked> weak(shared);
+  shared.reset();
+  EXPECT_EQ(Tracked::alive, 0); // Destroyed, only its storage is kept by the Weak
+}
+
+TEST(SharedLayoutTest, LargeObjectsRetainOnlyBlocksUnderWeak)
+{
+  static_assert(!sp::SharedLayout<LargeObject>::fused);
+  constexpr std::size_t Objects = 256;
+  LargeObject::alive = 0;
+  LargeObject::allocatedBytes = 0;
+  std::vector<sp::Weak<LargeObject>> weaks;
+  {
+    std::vector<sp::Shared<LargeObject>> shareds;
+    for (std::size_t i = 0; i < Objects; ++i)
+    {
+      shareds.push_back(sp::Shared<LargeObject>::makeShared());
+      weaks.emplace_back(shareds.back());
+    }
+    EXPECT_EQ(LargeObject::alive, static_cast<int>(Objects));
+    EXPECT_EQ(LargeObject::allocatedBytes, Objects * sizeof(LargeObject)); // Allocated apart from the blocks
+  }
+  EXPECT_EQ(LargeObject::alive, 0);
+  EXPECT_EQ(LargeObject::allocatedBytes, 0u); // The object memory is back while the Weak pointers live
+  for (const sp::Weak<LargeObject> &weak : weaks)
+  {
+    EXPECT_TRUE(weak.expired());
+  }
+}
+
+#endif // TEST_LAYOUT
+
+#if TEST_OWNER
+/******************************************
+ * Test owner-based ordering and hashing  *
+ ******************************************/
+
+TEST(OwnerTest, SharedAndWeakShareOwner)
+{
+  auto shared = sp::Shared<int>::makeShared(5);
+  sp::Shared<int> copy = shared;
+  sp::Weak<int> weak(shared);
+  auto other = sp::Shared<int>::makeShared(5);
+  EXPECT_TRUE(shared.ownerEqual(copy));
+  EXPECT_TRUE(shared.ownerEqual(weak));
+  EXPECT_TRUE(weak.ownerEqual(shared));
+  EXPECT_FALSE(shared.ownerEqual(other));
+  EXPECT_NE(shared.ownerBefore(other), other.ownerBefore(shared));
+  EXPECT_FALSE(shared.ownerBefore(weak));
+  EXPECT_EQ(std::hash<sp::Shared<int>>()(shared), std::hash<sp::Weak<int>>()(weak));
+  EXPECT_EQ(shared.count(), 2); // Never touched by comparisons
+}
+
+TEST(OwnerTest, ExpiredWeakKeepsIdentity)
+{
+  sp::Weak<int> weak;
+  std::size_t hash;
+  {
+    auto shared = sp::Shared<int>::makeShared(5);
+    weak = shared;
+    hash = shared.ownerHash();
+  }
+  EXPECT_TRUE(weak.expired());
+  EXPECT_EQ(weak.ownerHash(), hash);
+}
+
+TEST(OwnerTest, StandardContainers)
+{
+  auto first = sp::Shared<int>::makeShared(1);
+  auto second = sp::Shared<int>::makeShared(2);
+  std::set<sp::Weak<int>, sp::OwnerLess> ordered{sp::Weak<int>(first), sp::Weak<int>(second), sp::Weak<int>(first)};
+  EXPECT_EQ(ordered.size(), 2u);
+  std::unordered_set<sp::Shared<int>, std::hash<sp::Shared<int>>, sp::OwnerEqual> hashed{first, second, first};
+  EXPECT_EQ(hashed.size(), 2u);
+}
+
+TEST(OwnerTest, WeakSetLazyRemoval)
+{
+  sp::WeakSet<int> set;
+  auto kept = sp::Shared<int>::makeShared(0);
+  EXPECT_TRUE(set.insert(kept));
+  EXPECT_FALSE(set.insert(kept));
+  for (int i = 0; i < 100; ++i)
+  {
+    auto temporary = sp::Shared<int>::makeShared(i);
+    set.insert(temporary);
+  }
+  EXPECT_LT(set.size(), 101u); // Expired entries were purged while inserting
+  EXPECT_TRUE(set.contains(kept));
+  set.purge();
+  EXPECT_EQ(set.size(), 1u);
+  EXPECT_EQ(set.lock().size(), 1u);
+  EXPECT_TRUE(set.erase(kept));
+  EXPECT_EQ(set.size(), 0u);
+}
+
+TEST(OwnerTest, WeakMapValues)
+{
+  sp::WeakMap<int, std::string> map;
+  auto key = sp::Shared<int>::makeShared(1);
+  map[key] = "one";
+  {
+    auto temporary = sp::Shared<int>::makeShared(2);
+    map[temporary] = "two";
+    EXPECT_EQ(*map.find(temporary), "two");
+  }
+  EXPECT_EQ(map.size(), 2u);
+  map.purge();
+  EXPECT_EQ(map.size(), 1u);
+  ASSERT_NE(map.find(key), nullptr);
+  EXPECT_EQ(*map.find(key), "one");
+  EXPECT_EQ(key.count(), 1);
+}
+
+#endif // TEST_OWNER
+
+#if TEST_SEGMENT
+/******************************************
+ * Test the OffsetPtr and Segment classes *
+ ******************************************/
+
+namespace
+{
+  struct Node
+  {
+    int value;
+    sp::SegmentShared<Node> next;
+
+    Node(int value) : value(value) {}
+  };
+
+  // build a list of the given length in the segment, the head is the root
+  void buildList(sp::Segment &segment, int length)
+  {
+    sp::SegmentShared<Node> head;
+    for (int i = length; i > 0; --i)
+    {
+      auto node = segment.makeShared<Node>(i);
+      node->next = std::move(head);
+      head = std::move(node);
+    }
+    auto *root = new (segment.allocate(sizeof(sp::SegmentShared<Node>))) sp::SegmentShared<Node>(std::move(head));
+    segment.setRoot(root);
+  }
+
+  int sumList(const sp::Segment &segment)
+  {
+    int sum = 0;
+    for (Node *node = segment.root<sp::SegmentShared<Node>>()->get(); node; node = node->next.get())
+    {
+      sum += node->value;
+    }
+    return sum;
+  }
+}
+
+TEST(SegmentTest, OffsetPtrCopiesKeepTarget)
+{
+  int values[2] = {1, 2};
+  sp::OffsetPtr<int> ptr(&values[1]);
+  sp::OffsetPtr<int> copy = ptr;
+  EXPECT_EQ(copy.get(), &values[1]);
+  EXPECT_EQ(*copy, 2);
+  sp::OffsetPtr<int> null;
+  EXPECT_FALSE(null);
+  EXPECT_EQ(null.get(), nullptr);
+}
+
+TEST(SegmentTest, SharedCountsAndReuse)
+{
+  auto segment = sp::Segment::anonymous(1 << 16);
+  std::size_t used;
+  {
+    auto shared = segment.makeShared<Node>(5);
+    EXPECT_TRUE(segment.contains(shared.get()));
+    auto copy = shared;
+    EXPECT_EQ(copy.count(), 2);
+    used = segment.used();
+  }
+  auto again = segment.makeShared<Node>(6); // Reuses the freed chunk
+  EXPECT_EQ(segment.used(), used);
+  auto unique = segment.makeUnique<int>(7);
+  EXPECT_EQ(*unique, 7);
+}
+
+TEST(SegmentTest, GraphValidAtAnyAddress)
+{
+  std::string path = testing::TempDir() + "sp_segment_test";
+  {
+    auto segment = sp::Segment::create(path, 1 << 20);
+    buildList(segment, 100);
+    segment.sync();
+    auto other = sp::Segment::open(path); // Second mapping of the same file
+    EXPECT_NE(other.base(), segment.base());
+    EXPECT_EQ(sumList(other), 5050);
+  }
+  auto reopened = sp::Segment::open(path);
+  EXPECT_EQ(sumList(reopened), 5050);
+  EXPECT_EQ(reopened.root<sp::SegmentShared<Node>>()->count(), 1);
+  ::unlink(path.c_str());
+}
+
+TEST(SegmentTest, OpenRejectsOtherFiles)
+{
+  std::string path = testing::TempDir() + "sp_segment_invalid";
+  {
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    std::fputs("not a segment, but long enough to hold a segment header", file);
+    std::fclose(file);
+  }
+  EXPECT_THROW(sp::Segment::open(path), std::runtime_error);
+  ::unlink(path.c_str());
+}
+
+TEST(SegmentTest, EmptyAllocationsHoldFreeListLink)
+{
+  auto segment = sp::Segment::anonymous(1 << 16);
+  void *first = segment.allocate(0);
+  void *second = segment.allocate(0);
+  EXPECT_NE(first, second);
+  segment.deallocate(first);
+  segment.deallocate(second); // Links to first from its own payload, must not reach the next chunk
+  std::size_t used = segment.used();
+  EXPECT_EQ(segment.allocate(0), second);
+  EXPECT_EQ(segment.allocate(0), first);
+  EXPECT_EQ(segment.used(), used);
+}
+
+#endif // TEST_SEGMENT
+
+#if TEST_IPC
+/******************************************
+ * Test the IpcShared class               *
+ ******************************************/
+
+namespace
+{
+  struct Table
+  {
+    int rows[256];
+  };
+
+  /**
+   * @brief Run a function in a forked child, return its exit code
+   */
+  template <typename Function>
+  int inChild(Function function)
+  {
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+      ::_exit(function());
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  }
+}
+
+TEST(IpcSharedTest, CountsAndFree)
+{
+  auto segment = sp::IpcSegment::anonymous(1 << 20);
+  std::size_t used;
+  {
+    auto table = segment.makeShared<Table>();
+    table->rows[0] = 42;
+    auto copy = table;
+    EXPECT_EQ(copy.count(), 2);
+    EXPECT_EQ(copy->rows[0], 42);
+    used = segment.segment().used();
+  }
+  auto again = segment.makeShared<Table>(); // The freed block is reused
+  EXPECT_EQ(segment.segment().used(), used);
+}
+
+TEST(IpcSharedTest, SharedWithChildProcess)
+{
+  auto segment = sp::IpcSegment::anonymous(1 << 20);
+  auto table = segment.makeShared<Table>();
+  table->rows[1] = 7;
+  segment.publish(table);
+  int code = inChild([&segment]()
+                     {
+    auto seen = segment.published<Table>();
+    if (seen->rows[1] != 7)
+    {
+      return 1;
+    }
+    seen->rows[1] = 8; // Same memory as the parent
+    return seen.count() == 3 ? 0 : 2; });
+  EXPECT_EQ(code, 0);
+  EXPECT_EQ(table->rows[1], 8);
+  EXPECT_EQ(table.count(), 2); // The child released its reference on exit
+}
+
+TEST(IpcSharedTest, RecoverCrashedProcess)
+{
+  auto segment = sp::IpcSegment::anonymous(1 << 20);
+  auto table = segment.makeShared<Table>();
+  segment.publish(table);
+  int code = inChild([&segment]()
+                     {
+    auto first = new sp::IpcShared<Table>(segment.published<Table>());
+    auto second = new sp::IpcShared<Table>(*first);
+    (void)second;
+    return 0; }); // Exits without releasing, as a crash would
+  EXPECT_EQ(code, 0);
+  EXPECT_EQ(table.count(), 4);
+  EXPECT_EQ(segment.recover(), 1u);
+  EXPECT_EQ(table.count(), 2);
+  EXPECT_EQ(segment.recover(), 0u);
+}
+
+TEST(IpcSharedTest, LastHandleInChildFrees)
+{
+  auto segment = sp::IpcSegment::anonymous(1 << 20);
+  {
+    auto table = segment.makeShared<Table>();
+    segment.publish(table);
+  }
+  std::size_t used = segment.segment().used();
+  int code = inChild([&segment]()
+                     {
+    auto table = segment.published<Table>();
+    segment.publish(sp::IpcShared<Table>());
+    return table.count() == 1 ? 0 : 1; }); // The child drops the last reference
+  EXPECT_EQ(code, 0);
+  auto reused = segment.makeShared<Table>();
+  EXPECT_EQ(segment.segment().used(), used);
+}
+
+TEST(IpcSharedTest, PublishWhileOthersRead)
+{
+  struct Stamp
+  {
+    std::uint64_t value;
+    std::uint64_t check; // Complement of value, a freed and reused block breaks it
+  };
+  auto segment = sp::IpcSegment::anonymous(1 << 20);
+  constexpr int Rounds = 20000;
+  std::vector<pid_t> children;
+  for (int child = 0; child < 4; ++child)
+  {
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+      for (std::uint64_t round = 0; round < Rounds; ++round)
+      {
+        if (child % 2 == 0)
+        {
+          auto stamp = segment.makeShared<Stamp>();
+          stamp->value = round;
+          stamp->check = ~round;
+          segment.publish(stamp);
+        }
+        else if (auto seen = segment.published<Stamp>())
+        {
+          if (seen->check != ~seen->value || seen.count() < 1)
+          {
+            ::_exit(1);
+          }
+        }
+      }
+      ::_exit(0);
+    }
+    children.push_back(pid);
+  }
+  for (pid_t pid : children)
+  {
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  auto last = segment.published<Stamp>();
+  ASSERT_TRUE(last);
+  EXPECT_EQ(last->check, ~last->value);
+  EXPECT_EQ(last.count(), 2); // The segment and this process, every child released its references
+  EXPECT_EQ(segment.recover(), 4u); // The ledgers of the children are freed, not references
+  EXPECT_EQ(last.count(), 2);
+}
+
+#endif // TEST_IPC
+
+#if TEST_LAZY
+/******************************************
+ * Test the Lazy class                    *
+ ******************************************/
+
+TEST(LazyTest, BuiltOnFirstAccess)
+{
+  int calls = 0;
+  sp::Lazy<int> lazy([&calls]()
+                     { ++calls; return sp::Shared<int>::makeShared(5); });
+  EXPECT_FALSE(lazy.initialized());
+  EXPECT_EQ(calls, 0);
+  EXPECT_EQ(*lazy, 5);
+  EXPECT_EQ(*lazy, 5);
+  EXPECT_TRUE(lazy.initialized());
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(LazyTest, DefaultFactory)
+{
+  sp::Lazy<std::string> lazy;
+  EXPECT_TRUE(lazy->empty());
+}
+
+TEST(LazyTest, FactoryRunsOnceUnderConcurrency)
+{
+  std::atomic<int> calls(0);
+  sp::Lazy<int> lazy([&calls]()
+                     {
+    ++calls;
+    std::this_thread::yield();
+    return sp::Shared<int>::makeShared(42); });
+  std::vector<std::thread> threads;
+  std::atomic<int *> seen[8] = {};
+  for (int t = 0; t < 8; ++t)
+  {
+    threads.emplace_back([&lazy, &seen, t]()
+                         { seen[t] = lazy.get(); });
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+  EXPECT_EQ(calls, 1);
+  for (auto &ptr : seen)
+  {
+    EXPECT_EQ(ptr.load(), seen[0].load()); // Every thread sees the same object
+  }
+}
+
+TEST(LazyTest, SharedAndWeakObservers)
+{
+  sp::Lazy<int> lazy([]()
+                     { return sp::Shared<int>::makeShared(3); });
+  sp::Weak<int> weak = lazy.weak();
+  EXPECT_FALSE(weak.expired());
+  sp::Shared<int> shared = lazy.shared();
+  EXPECT_EQ(shared.count(), 2); // The holder and this copy
+  EXPECT_EQ(*weak.lock(), 3);
+}
+
+TEST(LazyTest, RetryAfterFailure)
+{
+  int calls = 0;
+  sp::Lazy<int> lazy([&calls]()
+                     {
+    if (++calls == 1)
+    {
+      throw std::runtime_error("first call fails");
+    }
+    return sp::Shared<int>::makeShared(7); });
+  EXPECT_THROW(lazy.get(), std::runtime_error);
+  EXPECT_FALSE(lazy.initialized());
+  EXPECT_EQ(*lazy, 7);
+  EXPECT_EQ(calls, 2);
+}
+
+#endif // TEST_LAZY
+
+#if TEST_ATOMICWEAK
+/******************************************
+ * Test the AtomicWeak class              *
+ ******************************************/
+
+TEST(AtomicWeakTest, LoadStoreExchange)
+{
+  sp::Shared<int> first = sp::Shared<int>::makeShared(1);
+  sp::Shared<int> second = sp::Shared<int>::makeShared(2);
+  sp::AtomicWeak<int> slot;
+  EXPECT_TRUE(slot.empty());
+  EXPECT_FALSE(slot.lock());
+  slot.store(sp::Weak<int>(first));
+  EXPECT_EQ(*slot.lock(), 1);
+  EXPECT_TRUE(slot.load().ownerEqual(first));
+  sp::Weak<int> previous = slot.exchange(sp::Weak<int>(second));
+  EXPECT_TRUE(previous.ownerEqual(first));
+  EXPECT_EQ(*slot.lock(), 2);
+  EXPECT_EQ(second.count(), 1); // The slot only holds a weak reference
+}
+
+TEST(AtomicWeakTest, StoredBlocksAreFlagged)
+{
+  sp::Shared<int> shared(new int(1));
+  sp::Shared<int> other(new int(2));
+  sp::AtomicWeak<int> slot{sp::Weak<int>(shared)};
+  EXPECT_TRUE(shared.owner()->hazardous());
+  EXPECT_FALSE(other.owner()->hazardous());
+  slot.store(sp::Weak<int>(other));
+  EXPECT_TRUE(other.owner()->hazardous());
+  EXPECT_EQ(*slot.lock(), 2);
+}
+
+TEST(AtomicWeakTest, CompareExchange)
+{
+  sp::Shared<int> first = sp::Shared<int>::makeShared(1);
+  sp::Shared<int> second = sp::Shared<int>::makeShared(2);
+  sp::AtomicWeak<int> slot{sp::Weak<int>(first)};
+  sp::Weak<int> expected(second);
+  EXPECT_FALSE(slot.compareExchange(expected, sp::Weak<int>(second)));
+  EXPECT_TRUE(expected.ownerEqual(first)); // Updated to the current one
+  EXPECT_TRUE(slot.compareExchange(expected, sp::Weak<int>(second)));
+  EXPECT_EQ(*slot.lock(), 2);
+}
+
+TEST(AtomicWeakTest, ExpiredObject)
+{
+  Tracked::alive = 0;
+  sp::AtomicWeak<Tracked> slot;
+  {
+    sp::Shared<Tracked> shared = sp::Shared<Tracked>::makeShared(1);
+    slot.store(sp::Weak<Tracked>(shared));
+  }
+  EXPECT_EQ(Tracked::alive, 0);
+  EXPECT_FALSE(slot.lock());
+  EXPECT_TRUE(slot.load().expired());
+  EXPECT_FALSE(slot.empty());
+}
+
+TEST(AtomicWeakTest, ConcurrentReadersAndWriters)
+{
+  Tracked::alive = 0;
+  {
+    sp::Shared<Tracked> initial = sp::Shared<Tracked>::makeShared(0);
+    sp::AtomicWeak<Tracked> slot(initial);
+    std::atomic<bool> stop(false);
+    std::atomic<long> locked(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+      threads.emplace_back([&slot, &stop, &locked]()
+                           {
+        while (!stop)
+        {
+          if (sp::Shared<Tracked> shared = slot.lock())
+          {
+            EXPECT_GE(shared->value, 0);
+            ++locked;
+          }
+          sp::Weak<Tracked> weak = slot.load();
+          weak.lock();
+        } });
+    }
+    for (int t = 0; t < 2; ++t)
+    {
+      threads.emplace_back([&slot, t]()
+                           {
+        for (int i = 0; i < 2000; ++i)
+        {
+          // the only Shared dies right away, readers race with both the object and the block deletion
+          sp::Shared<Tracked> shared = sp::Shared<Tracked>::makeShared(t * 2000 + i);
+          slot.store(sp::Weak<Tracked>(shared));
+        } });
+    }
+    threads[4].join();
+    threads[5].join();
+    stop = true;
+    for (int t = 0; t < 4; ++t)
+    {
+      threads[t].join();
+    }
+    EXPECT_GT(locked, 0);
+  }
+  sp::reclaimHazards();
+  EXPECT_EQ(Tracked::alive, 0);
+  EXPECT_EQ(sp::detail::HazardDomain::instance().pending(), 0u);
+}
+
+#endif // TEST_ATOMICWEAK
+
+#if TEST_NOWEAK
+/******************************************
+ * Test the Shared of no-weak types       *
+ ******************************************/
+
+namespace
+{
+  // never observed by Weak pointers
+  struct Unobserved
+  {
+    static std::atomic<int> alive;
+    int value;
+    Unobserved(int value) : value(value) { ++alive; }
+    ~Unobserved() { --alive; }
+  };
+  std::atomic<int> Unobserved::alive(0);
+
+  struct LargeUnobserved
+  {
+    static std::atomic<int> alive;
+    char data[SP_SHARED_FUSED_THRESHOLD + 1];
+    LargeUnobserved() { ++alive; }
+    ~LargeUnobserved() { --alive; }
+  };
+  std::atomic<int> LargeUnobserved::alive(0);
+
+  // observed by Weak pointers, same size as Unobserved
+  struct Observed
+  {
+    int value;
+  };
+}
+
+template <>
+struct sp::WeakTraits<Unobserved> : sp::NoWeak
+{
+};
+
+template <>
+struct sp::DeferredTraits<Unobserved> : sp::DeferredEnabled
+{
+};
+
+template <>
+struct sp::WeakTraits<LargeUnobserved> : sp::NoWeak
+{
+};
+
+TEST(NoWeakTest, SmallerBlocks)
+{
+  static_assert(!std::is_base_of_v<sp::WeakBlockControl, sp::InplaceBlock<Unobserved>>);
+  static_assert(std::is_base_of_v<sp::WeakBlockControl, sp::InplaceBlock<Observed>>);
+  EXPECT_LT(sizeof(sp::InplaceBlock<Unobserved>), sizeof(sp::InplaceBlock<Observed>));
+  EXPECT_LT(sizeof(sp::PointerBlock<Unobserved>), sizeof(sp::PointerBlock<Observed>));
+  EXPECT_EQ(sp::SharedLayout<Unobserved>::retainedBytes, 0u);
+}
+
+TEST(NoWeakTest, LastReleaseDeletesObject)
+{
+  Unobserved::alive = 0;
+  {
+    auto shared = sp::Shared<Unobserved>::makeShared(3);
+    auto copy = shared;
+    EXPECT_EQ(copy.count(), 2);
+    EXPECT_EQ(copy->value, 3);
+    shared.reset();
+    EXPECT_EQ(Unobserved::alive, 1);
+  }
+  EXPECT_EQ(Unobserved::alive, 0);
+  {
+    sp::Shared<Unobserved> adopted(new Unobserved(4));
+    EXPECT_EQ(adopted->value, 4);
+  }
+  EXPECT_EQ(Unobserved::alive, 0);
+}
+
+TEST(NoWeakTest, SplitLayout)
+{
+  static_assert(!sp::SharedLayout<LargeUnobserved>::fused);
+  LargeUnobserved::alive = 0;
+  {
+    auto shared = sp::Shared<LargeUnobserved>::makeShared();
+    auto copy = shared;
+    EXPECT_EQ(LargeUnobserved::alive, 1);
+  }
+  EXPECT_EQ(LargeUnobserved::alive, 0);
+}
+
+TEST(NoWeakTest, DeferredCounts)
+{
+  Unobserved::alive = 0;
+  {
+    sp::DeferredCounts scope;
+    auto shared = sp::Shared<Unobserved>::makeShared(1);
+    for (int i = 0; i < 100; ++i)
+    {
+      auto copy = shared;
+    }
+  }
+  EXPECT_EQ(Unobserved::alive, 0);
+}
+
+#endif // TEST_NOWEAK
+
+#if TEST_BULK
+/******************************************
+ * Test the bulk release of Shared        *
+ ******************************************/
+
+TEST(BulkReleaseTest, ReleaseAllEmptiesTheRange)
+{
+  Tracked::alive = 0;
+  auto kept = sp::Shared<Tracked>::makeShared(-1);
+  std::vector<sp::Shared<Tracked>> shareds;
+  for (int i = 0; i < 100; ++i)
+  {
+    shareds.push_back(sp::Shared<Tracked>::makeShared(i));
+    shareds.push_back(kept); // Interleaved with another block, no run to merge
+  }
+  shareds.emplace_back(); // Empty pointers are skipped
+  sp::Weak<Tracked> weak(shareds.front());
+  EXPECT_EQ(kept.count(), 101);
+  sp::releaseAll(shareds);
+  EXPECT_EQ(Tracked::alive, 1);
+  EXPECT_EQ(kept.count(), 1);
+  EXPECT_TRUE(weak.expired());
+  for (const auto &shared : shareds)
+  {
+    EXPECT_FALSE(shared);
+  }
+}
+
+TEST(BulkReleaseTest, RunsOnTheSameBlock)
+{
+  Tracked::alive = 0;
+  std::vector<sp::Shared<Tracked>> shareds(1000, sp::Shared<Tracked>::makeShared(1));
+  EXPECT_EQ(shareds.front().count(), 1000);
+  sp::Shared<Tracked> last = shareds.back();
+  sp::releaseAll(shareds);
+  EXPECT_EQ(last.count(), 1);
+  last.reset();
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(BulkReleaseTest, BackgroundTeardown)
+{
+  Tracked::alive = 0;
+  std::vector<sp::Shared<Tracked>> shareds;
+  for (int i = 0; i < 1000; ++i)
+  {
+    shareds.push_back(sp::Shared<Tracked>::makeShared(i));
+  }
+  sp::releaseAll(shareds, sp::Teardown::Background);
+  sp::drainReleases();
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(BulkReleaseTest, SharedVector)
+{
+  Tracked::alive = 0;
+  {
+    sp::SharedVector<Tracked> vector;
+    for (int i = 0; i < 100; ++i)
+    {
+      vector.push_back(sp::Shared<Tracked>::makeShared(i));
+    }
+    sp::SharedVector<Tracked> copy = vector;
+    EXPECT_EQ(vector[0].count(), 2);
+    vector.clear();
+    EXPECT_TRUE(vector.empty());
+    EXPECT_EQ(Tracked::alive, 100); // Still held by the copy
+    copy.clear(sp::Teardown::Background);
+    sp::drainReleases();
+    EXPECT_EQ(Tracked::alive, 0);
+    for (int i = 0; i < 10; ++i)
+    {
+      vector.push_back(sp::Shared<Tracked>::makeShared(i));
+    }
+    copy = std::move(vector);
+    EXPECT_EQ(copy.size(), 10u);
+  }
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+#endif // TEST_BULK
+
+#if TEST_FUTURE
+/******************************************
+ * Test the Promise and Future classes    *
+ ******************************************/
+
+TEST(FutureTest, ValueAcrossThreads)
+{
+  sp::Promise<std::string> promise;
+  sp::Future<std::string> future = promise.getFuture();
+  EXPECT_FALSE(future.ready());
+  std::thread producer([&promise]()
+                       {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    promise.setValue("done"); });
+  EXPECT_EQ(future.get(), "done"); // Sleeps until the value is set
+  EXPECT_FALSE(future.valid());
+  producer.join();
+}
+
+TEST(FutureTest, ExceptionsAndBrokenPromise)
+{
+  sp::Future<int> failed;
+  {
+    sp::Promise<int> promise;
+    failed = promise.getFuture();
+    promise.setException(std::make_exception_ptr(std::runtime_error("failed")));
+    EXPECT_THROW(promise.setValue(1), std::future_error);
+  }
+  EXPECT_THROW(failed.get(), std::runtime_error);
+
+  sp::Future<int> broken;
+  {
+    sp::Promise<int> promise;
+    broken = promise.getFuture();
+    EXPECT_THROW(promise.getFuture(), std::future_error);
+  }
+  EXPECT_THROW(broken.get(), std::future_error);
+}
+
+TEST(FutureTest, ThrowingResultLeavesPromiseUnsatisfied)
+{
+  struct Fragile
+  {
+    int value;
+    explicit Fragile(int value) : value(value)
+    {
+      if (value < 0)
+      {
+        throw std::invalid_argument("negative");
+      }
+    }
+  };
+  sp::Future<Fragile> future;
+  {
+    sp::Promise<Fragile> promise;
+    future = promise.getFuture();
+    EXPECT_THROW(promise.setValue(-1), std::invalid_argument);
+    EXPECT_FALSE(future.ready());
+    promise.setValue(2); // Not satisfied by the failed attempt
+  }
+  EXPECT_EQ(future.get().value, 2);
+
+  sp::Future<Fragile> broken;
+  {
+    sp::Promise<Fragile> promise;
+    broken = promise.getFuture();
+    EXPECT_THROW(promise.setValue(-1), std::invalid_argument);
+  }
+  EXPECT_THROW(broken.get(), std::future_error); // Broken, not holding an unconstructed value
+}
+
+TEST(FutureTest, NoStateIsReported)
+{
+  sp::Future<int> future;
+  EXPECT_THROW(future.ready(), std::future_error);
+  EXPECT_THROW(future.wait(), std::future_error);
+  sp::Promise<int> promise;
+  future = promise.getFuture();
+  promise.setValue(1);
+  EXPECT_EQ(future.get(), 1);
+  EXPECT_THROW(future.ready(), std::future_error); // Consumed by get()
+}
+
+TEST(FutureTest, ThenChains)
+{
+  Tracked::alive = 0;
+  {
+    sp::Promise<int> promise;
+    sp::Future<std::string> future = promise.getFuture()
+                                         .then([](int value)
+                                               { return value * 2; })
+                                         .then([](int value)
+                                               { return std::to_string(value); });
+    EXPECT_FALSE(future.ready());
+    promise.setValue(21); // Runs the whole chain on this thread
+    EXPECT_TRUE(future.ready());
+    EXPECT_EQ(future.get(), "42");
+
+    // chained on a future already set, and dropped without being consumed
+    sp::makeReadyFuture<int>(1).then([](int value)
+                                     { return Tracked(value); });
+  }
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(FutureTest, ThenForwardsExceptions)
+{
+  bool called = false;
+  sp::Promise<int> promise;
+  sp::Future<int> future = promise.getFuture()
+                               .then([&called](int value)
+                                     { called = true; return value; })
+                               .then([](int) -> int
+                                     { throw std::logic_error("unreachable"); });
+  promise.setException(std::make_exception_ptr(std::runtime_error("source")));
+  EXPECT_FALSE(called);
+  EXPECT_THROW(future.get(), std::runtime_error);
+
+  sp::Future<int> thrown = sp::makeReadyFuture<int>(1).then([](int) -> int
+                                                            { throw std::logic_error("stage"); });
+  EXPECT_THROW(thrown.get(), std::logic_error);
+}
+
+TEST(FutureTest, ThenResultConstructionIsGuarded)
+{
+  struct ThrowingMove
+  {
+    ThrowingMove() = default;
+    ThrowingMove(ThrowingMove &&)
+    {
+      throw std::length_error("move");
+    }
+  };
+  int downstream = 0;
+  sp::Promise<int> promise;
+  sp::Future<int> future = promise.getFuture()
+                               .then([](int)
+                                     { return ThrowingMove(); })
+                               .then([&downstream](ThrowingMove) -> int
+                                     { return ++downstream; });
+  promise.setValue(1);
+  EXPECT_EQ(downstream, 0); // The failed construction is the result, published once
+  EXPECT_THROW(future.get(), std::length_error);
+}
+
+TEST(FutureTest, ThenRacingTheProducer)
+{
+  for (int i = 0; i < 200; ++i)
+  {
+    sp::Promise<int> promise;
+    sp::Future<int> future = promise.getFuture();
+    std::thread producer([&promise, i]()
+                         { promise.setValue(i); });
+    sp::Future<int> next = future.then([](int value)
+                                       { return value + 1; });
+    EXPECT_EQ(next.get(), i + 1);
+    producer.join();
+  }
+}
+
+#endif // TEST_FUTURE
+
+#if TEST_CHANNEL
+/******************************************
+ * Test the Channel class                 *
+ ******************************************/
+
+TEST(ChannelTest, FifoAndCapacity)
+{
+  sp::Channel<sp::Unique<int>> channel(3);
+  EXPECT_EQ(channel.capacity(), 4u);
+  for (int i = 0; i < 4; ++i)
+  {
+    EXPECT_TRUE(channel.tryPush(sp::Unique<int>::makeUnique(i)));
+  }
+  sp::Unique<int> extra = sp::Unique<int>::makeUnique(4);
+  EXPECT_FALSE(channel.tryPush(std::move(extra)));
+  EXPECT_TRUE(extra); // Left to the caller when the channel is full
+  for (int i = 0; i < 4; ++i)
+  {
+    EXPECT_EQ(*channel.tryPop(), i);
+  }
+  EXPECT_FALSE(channel.tryPop());
+}
+
+TEST(ChannelTest, BatchPushAndPop)
+{
+  sp::Channel<sp::Unique<int>> channel(8);
+  sp::Unique<int> items[10];
+  for (int i = 0; i < 10; ++i)
+  {
+    items[i] = sp::Unique<int>::makeUnique(i);
+  }
+  EXPECT_EQ(channel.tryPushBatch(items, 10), 8u); // Only the room there is
+  EXPECT_TRUE(items[8]);
+  sp::Unique<int> out[5];
+  EXPECT_EQ(channel.tryPopBatch(out, 5), 5u);
+  for (int i = 0; i < 5; ++i)
+  {
+    EXPECT_EQ(*out[i], i);
+  }
+  EXPECT_EQ(channel.tryPushBatch(items + 8, 2), 2u);
+  sp::Unique<int> rest[8];
+  EXPECT_EQ(channel.tryPopBatch(rest, 8), 5u);
+  EXPECT_EQ(*rest[4], 9);
+}
+
+TEST(ChannelTest, DestructorFreesQueuedItems)
+{
+  Tracked::alive = 0;
+  {
+    sp::Channel<sp::Unique<Tracked>> channel(16);
+    for (int i = 0; i < 10; ++i)
+    {
+      channel.push(sp::Unique<Tracked>::makeUnique(i));
+    }
+    EXPECT_EQ(Tracked::alive, 10);
+  }
+  EXPECT_EQ(Tracked::alive, 0);
+}
+
+TEST(ChannelTest, CloseWakesConsumers)
+{
+  sp::Channel<sp::Unique<int>> channel(4);
+  channel.push(sp::Unique<int>::makeUnique(1));
+  std::thread consumer([&channel]()
+                       {
+    EXPECT_EQ(*channel.pop(), 1);
+    EXPECT_FALSE(channel.pop()); // Sleeps until the close
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  channel.close();
+  consumer.join();
+  EXPECT_FALSE(channel.push(sp::Unique<int>::makeUnique(2)));
+}
+
+TEST(ChannelTest, ManyProducersAndConsumers)
+{
+  constexpr int Producers = 4;
+  constexpr int Consumers = 4;
+  constexpr int PerProducer = 5000;
+  sp::Channel<sp::Unique<int>> channel(64); // Small, producers and consumers both block
+  std::atomic<long> sum(0);
+  std::atomic<int> received(0);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < Producers; ++p)
+  {
+    threads.emplace_back([&channel, p]()
+                         {
+      for (int i = 0; i < PerProducer; i += 2)
+      {
+        sp::Unique<int> pair[2] = {sp::Unique<int>::makeUnique(p * PerProducer + i), sp::Unique<int>::makeUnique(p * PerProducer + i + 1)};
+        EXPECT_EQ(channel.pushBatch(pair, 2), 2u);
+      } });
+  }
+  for (int c = 0; c < Consumers; ++c)
+  {
+    threads.emplace_back([&channel, &sum, &received]()
+                         {
+      sp::Unique<int> batch[8];
+      while (std::size_t count = channel.popBatch(batch, 8))
+      {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          sum += *batch[i];
+        }
+        received += static_cast<int>(count);
+      } });
+  }
+  for (int p = 0; p < Producers; ++p)
+  {
+    threads[p].join();
+  }
+  channel.close();
+  for (int c = 0; c < Consumers; ++c)
+  {
+    threads[Producers + c].join();
+  }
+  constexpr long Total = Producers * PerProducer;
+  EXPECT_EQ(received, Total);
+  EXPECT_EQ(sum, Total * (Total - 1) / 2);
+}
+
+TEST(ChannelTest, CloseRacingPushes)
+{
+  constexpr int Producers = 4;
+  constexpr int Consumers = 2;
+  for (int round = 0; round < 50; ++round)
+  {
+    sp::Channel<sp::Unique<int>> channel(32);
+    std::atomic<int> pushed(0);
+    std::atomic<int> received(0);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < Producers; ++p)
+    {
+      threads.emplace_back([&channel, &pushed]()
+                           {
+        while (channel.push(sp::Unique<int>::makeUnique(1)))
+        {
+          ++pushed;
+        } });
+    }
+    for (int c = 0; c < Consumers; ++c)
+    {
+      threads.emplace_back([&channel, &received]()
+                           {
+        while (sp::Unique<int> item = channel.pop())
+        {
+          received += *item;
+        } });
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    channel.close();
+    for (std::thread &thread : threads)
+    {
+      thread.join();
+    }
+    EXPECT_EQ(received, pushed); // Every accepted push is popped before pop returns empty
+    EXPECT_FALSE(channel.tryPop());
+  }
+}
+
+#endif // TEST_CHANNEL
+
+#if TEST_CHECKED && defined(SP_CHECKED)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checking mode
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct CheckFailure : std::logic_error
+{
+  using std::logic_error::logic_error;
+};
+
+class CheckedTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    sp::setCheckFailureHandler([](const char *message)
+                               { throw CheckFailure(message); });
+  }
+
+  void TearDown() override
+  {
+    sp::setCheckFailureHandler(nullptr);
+  }
+
+  // copy a handle without taking a reference, as a bug leaves a dangling one behind
+  template <typename Pointer>
+  static void forge(Pointer &stale, const Pointer &source)
+  {
+    std::memcpy(static_cast<void *>(&stale), static_cast<const void *>(&source), sizeof(Pointer));
+  }
+
+  // empty a forged handle without releasing anything
+  template <typename Pointer>
+  static void forget(Pointer &stale)
+  {
+    std::memset(static_cast<void *>(&stale), 0, sizeof(Pointer));
+  }
+};
+
+TEST_F(CheckedTest, HealthyUseIsSilent)
+{
+  // enough blocks to wrap the quarantine several times
+  for (int i = 0; i < 1000; ++i)
+  {
+    sp::Shared<int> shared = sp::Shared<int>::makeShared(i);
+    sp::Shared<int> copy = shared;
+    sp::Weak<int> weak(copy);
+    EXPECT_EQ(*weak.lock(), i);
+    shared.reset();
+    copy.reset();
+    EXPECT_FALSE(weak.lock());
+  }
+}
+
+TEST_F(CheckedTest, StaleSharedIsReported)
+{
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(42);
+  sp::Shared<int> stale;
+  forge(stale, shared);
+  shared.reset(); // Deletes the block, the stale copy never had a reference
+  try
+  {
+    *stale;
+    FAIL() << "dereference of a deleted block not reported";
+  }
+  catch (const CheckFailure &failure)
+  {
+    EXPECT_NE(std::string(failure.what()).find("deleted"), std::string::npos);
+  }
+  EXPECT_THROW(sp::Shared<int> copy(stale), CheckFailure);
+  forget(stale);
+}
+
+TEST_F(CheckedTest, StaleSharedInReleaseAll)
+{
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(42);
+  sp::Shared<int> seven = sp::Shared<int>::makeShared(7);
+  std::vector<sp::Shared<int>> shareds(3, seven);
+  shareds.emplace_back();
+  forge(shareds.back(), shared);
+  shared.reset();
+  EXPECT_THROW(sp::releaseAll(shareds), CheckFailure);
+  EXPECT_EQ(seven.count(), 1); // The run before the stale handle was released
+  EXPECT_TRUE(shareds.back());
+  forget(shareds.back());
+}
+
+TEST_F(CheckedTest, StaleWeakIsReported)
+{
+  sp::Shared<int> shared = sp::Shared<int>::makeShared(42);
+  sp::Weak<int> weak(shared);
+  sp::Weak<int> stale;
+  forge(stale, weak);
+  weak.reset();
+  shared.reset(); // Last Shared and last Weak gone, the block is deleted
+  EXPECT_THROW(stale.lock(), CheckFailure);
+  forget(stale);
+}
+
+TEST_F(CheckedTest, DeletedBlocksAreQuarantined)
+{
+  std::set<const sp::BlockControl *> blocks;
+  for (std::size_t i = 0; i < sp::detail::Quarantine::Capacity / 2; ++i)
+  {
+    sp::Shared<int> shared = sp::Shared<int>::makeShared(static_cast<int>(i));
+    blocks.insert(shared.owner()); // Freed right away, the allocator would hand the same memory back
+  }
+  EXPECT_EQ(blocks.size(), sp::detail::Quarantine::Capacity / 2);
+}
+
+#endif // TEST_CHECKED
+
 int main(int argc, char *argv[])
 {
   ::testing::InitGoogleTest(&argc, argv);